@@ -28,9 +28,74 @@
   #include "HAL_softserial_STM32.h"
 #elif HAL_SS_PLATFORM == HAL_PLATFORM_SAMD51
   #include "HAL_softserial_SAMD51.h"
+#elif HAL_SS_PLATFORM == HAL_PLATFORM_LINUX
+  #include "HAL_softserial_LINUX.h"
 #else
   #error "Unsupported Platform!"
 #endif
 
+#ifndef HAL_softserial_busy_wait
+  #define HAL_softserial_busy_wait()
+#endif
+
+// 1 when the HAL masks and unmasks the RX pin interrupt with gpio_edge_enable()
+// and gpio_edge_disable(), which edge wake and capture decoding need
+#ifndef HAL_SS_EDGE_WAKE
+  #define HAL_SS_EDGE_WAKE 0
+#endif
+
+#if !HAL_SS_EDGE_WAKE
+  #define gpio_edge_enable(IO)  ((void)0)
+  #define gpio_edge_disable(IO) ((void)0)
+#endif
+
+// 1 when the HAL time stamps pin edges with HAL_softserial_edge_time(), a
+// free running counter at HAL_softserial_edge_clock() Hz
+#ifndef HAL_SS_EDGE_CAPTURE
+  #define HAL_SS_EDGE_CAPTURE 0
+#endif
+
+#define SS_EDGE_FALLING 0
+#define SS_EDGE_RISING  1
+#define SS_EDGE_CHANGE  2
+
 void HAL_softSerial_init();
-void HAL_softserial_setSpeed(uint32_t speed);
+void HAL_softserial_setRate(uint32_t rate);       // timer interrupts per second, 0 stops the timer
+// Average timer tick period, in ps, that HAL_softserial_setRate(rate) realizes
+uint64_t HAL_softserial_tick_time(uint32_t rate);
+// Part of the running timer period gone by, in 1/65536ths
+uint32_t HAL_softserial_tick_elapsed();
+
+// RX pin interrupt: attach leaves it disabled, gpio_edge_enable() clears any
+// stale edge and unmasks it, gpio_edge_disable() masks it
+void HAL_softserial_edge_attach(int16_t pin, uint8_t edge, void (*handler)());
+void HAL_softserial_edge_detach(int16_t pin);
+
+// 1 when the HAL samples a whole input port into a circular buffer with
+// timer triggered DMA. Samples are ss_sample_t port words taken at rate Hz,
+// HAL_softserial_dma_rx_pos() is the index the next one goes to, and the
+// HAL calls SoftSerial_DMA_RX_Handler() at half and full buffer.
+#ifndef HAL_SS_DMA_RX
+  #define HAL_SS_DMA_RX 0
+#endif
+
+#if HAL_SS_DMA_RX
+  void HAL_softserial_dma_rx_start(ss_port_t port, uint32_t rate, volatile ss_sample_t *buf, uint16_t len);
+  void HAL_softserial_dma_rx_stop();
+  uint16_t HAL_softserial_dma_rx_pos();
+  extern "C" void SoftSerial_DMA_RX_Handler(void);
+#endif
+
+// 1 when the HAL outputs a TX waveform with timer triggered DMA: one
+// ss_wave_t word per bit from a circular buffer at rate Hz, each made by
+// gpio_wave_word(mask, level). The HAL calls SoftSerial_DMA_TX_Handler()
+// with the half of the buffer that has just been sent.
+#ifndef HAL_SS_DMA_TX
+  #define HAL_SS_DMA_TX 0
+#endif
+
+#if HAL_SS_DMA_TX
+  void HAL_softserial_dma_tx_start(ss_port_t port, uint32_t rate, const volatile ss_wave_t *wave, uint16_t len);
+  void HAL_softserial_dma_tx_stop();
+  extern "C" void SoftSerial_DMA_TX_Handler(uint8_t half);
+#endif
@@ -0,0 +1,220 @@
+/**
+ * FYSETC
+ *
+ * Copyright (c) 2019 SoftwareSerialM [https://github.com/FYSETC/SoftwareSerialM]
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/**
+ * HAL for host builds (Linux)
+ */
+#include "HAL_platform.h"
+
+#if HAL_SS_PLATFORM == HAL_PLATFORM_LINUX
+
+#include <string.h>
+#include "HAL_softserial.h"
+
+volatile uint32_t HAL_softserial_port[SS_VIRTUAL_PORTS];
+void (*HAL_softserial_tick_hook)(uint64_t now_ns) = NULL;
+
+static uint32_t ss_tick_rate = 0;        // 0 while stopped
+static uint64_t ss_tick_ps = 1000000;    // timer period in picoseconds, kept while stopped
+static uint64_t ss_next_tick_ps;
+static uint64_t ss_fine_ps = 1000000;    // shortest timer period so far
+static uint64_t ss_step_ps = 1000000;
+static uint64_t ss_time_ps = 0;
+static uint64_t ss_ticks = 0;
+static uint64_t ss_hold_ps = 0;          // timer interrupt held off until then
+static bool ss_tick_pending = false;
+
+// Simulated pin interrupts, checked once per step
+static struct {
+  int16_t pin;
+  uint8_t edge;
+  bool enabled;
+  uint8_t level;
+  void (*handler)();
+} ss_edge[SS_VIRTUAL_EDGES];
+static uint8_t ss_edges_attached = 0;   // slots in use
+static uint8_t ss_edges_enabled = 0;
+
+// Simulated DMA sampling and waveform output, NULL buffer while stopped
+static volatile ss_sample_t *ss_dma_buf = NULL;
+static ss_port_t ss_dma_port;
+static uint16_t ss_dma_len, ss_dma_pos;
+static uint64_t ss_dma_ps, ss_dma_next_ps;
+
+static const volatile ss_wave_t *ss_wave = NULL;
+static ss_port_t ss_wave_port;
+static uint16_t ss_wave_len, ss_wave_pos;
+static uint64_t ss_wave_ps, ss_wave_next_ps;
+
+// Step at the timer period, at the fastest DMA rate while the timer is
+// stopped, and no coarser than the shortest timer period so far while pin
+// interrupts are enabled, so that edges are seen about as soon as the timer
+// could see them.
+static void ss_update_step() {
+  uint64_t step = ss_tick_ps;
+  if (!ss_tick_rate) {
+    if (ss_wave) step = ss_wave_ps;
+    if (ss_dma_buf && (!ss_wave || ss_dma_ps < step)) step = ss_dma_ps;
+  }
+  if (ss_edges_enabled && ss_fine_ps < step) step = ss_fine_ps;
+  ss_step_ps = step;
+}
+
+void HAL_softSerial_init() {
+  // All lines idle high, as if pulled up
+  memset((void *)HAL_softserial_port, 0xFF, sizeof(HAL_softserial_port));
+}
+
+void HAL_softserial_setRate(uint32_t rate) {
+  ss_tick_rate = rate;
+  if (rate) {
+    ss_tick_ps = HAL_softserial_tick_time(rate);
+    ss_next_tick_ps = ss_time_ps + ss_tick_ps;
+    if (ss_tick_ps < ss_fine_ps) ss_fine_ps = ss_tick_ps;
+  }
+  ss_update_step();
+}
+
+uint64_t HAL_softserial_tick_time(uint32_t rate) {
+  return 1000000000000ULL / rate;
+}
+
+uint32_t HAL_softserial_tick_elapsed() {
+  if (!ss_tick_rate) return 0;
+  return ((ss_time_ps + ss_tick_ps - ss_next_tick_ps) << 16) / ss_tick_ps;
+}
+
+void HAL_softserial_edge_enable(int16_t pin, bool enable) {
+  for (uint8_t i = 0; i < ss_edges_attached; i++)
+    if (ss_edge[i].handler && ss_edge[i].pin == pin) {
+      // edges from before enabling are not pending
+      ss_edge[i].level = gpio_get(pin);
+      if (enable != ss_edge[i].enabled) {
+        ss_edge[i].enabled = enable;
+        if (enable) ss_edges_enabled++; else ss_edges_enabled--;
+        ss_update_step();
+      }
+    }
+}
+
+void HAL_softserial_edge_detach(int16_t pin) {
+  HAL_softserial_edge_enable(pin, false);
+  for (uint8_t i = 0; i < ss_edges_attached; i++)
+    if (ss_edge[i].handler && ss_edge[i].pin == pin)
+      ss_edge[i].handler = NULL;
+}
+
+void HAL_softserial_edge_attach(int16_t pin, uint8_t edge, void (*handler)()) {
+  HAL_softserial_edge_detach(pin);
+  for (uint8_t i = 0; i < SS_VIRTUAL_EDGES; i++)
+    if (!ss_edge[i].handler) {
+      ss_edge[i].pin = pin;
+      ss_edge[i].edge = edge;
+      ss_edge[i].enabled = false;
+      ss_edge[i].handler = handler;
+      if (i >= ss_edges_attached) ss_edges_attached = i + 1;
+      return;
+    }
+}
+
+void HAL_softserial_dma_rx_start(ss_port_t port, uint32_t rate, volatile ss_sample_t *buf, uint16_t len) {
+  ss_dma_port = port;
+  ss_dma_len = len;
+  ss_dma_pos = 0;
+  ss_dma_ps = 1000000000000ULL / rate;
+  ss_dma_next_ps = ss_time_ps + ss_dma_ps;
+  ss_dma_buf = buf;
+  ss_update_step();
+}
+
+void HAL_softserial_dma_rx_stop() {
+  ss_dma_buf = NULL;
+  ss_update_step();
+}
+
+void HAL_softserial_dma_tx_start(ss_port_t port, uint32_t rate, const volatile ss_wave_t *wave, uint16_t len) {
+  ss_wave_port = port;
+  ss_wave_len = len;
+  ss_wave_pos = 0;
+  ss_wave_ps = 1000000000000ULL / rate;
+  ss_wave_next_ps = ss_time_ps + ss_wave_ps;
+  ss_wave = wave;
+  ss_update_step();
+}
+
+void HAL_softserial_dma_tx_stop() {
+  ss_wave = NULL;
+  ss_update_step();
+}
+
+uint16_t HAL_softserial_dma_rx_pos() { return ss_dma_pos; }
+
+void HAL_softserial_hold(uint32_t ns) {
+  uint64_t until = ss_time_ps + (uint64_t)ns * 1000;
+  if (until > ss_hold_ps) ss_hold_ps = until;
+}
+
+uint32_t HAL_softserial_step(uint32_t steps) {
+  uint32_t n;
+  for (n = 0; n < steps && (ss_tick_rate || ss_edges_enabled || ss_dma_buf || ss_wave); n++) {
+    // never step past a timer tick or the end of a hold off
+    uint64_t next = ss_time_ps + ss_step_ps;
+    if (ss_tick_rate && ss_next_tick_ps < next) next = ss_next_tick_ps;
+    if (ss_hold_ps > ss_time_ps && ss_hold_ps < next) next = ss_hold_ps;
+    ss_time_ps = next;
+    if (HAL_softserial_tick_hook) HAL_softserial_tick_hook(ss_time_ps / 1000);
+    // like the interrupt flag, ticks due while held off run once
+    for (; ss_tick_rate && ss_next_tick_ps <= ss_time_ps; ss_next_tick_ps += ss_tick_ps)
+      ss_tick_pending = true;
+    if (ss_tick_pending && ss_hold_ps <= ss_time_ps) {
+      ss_tick_pending = false;
+      ss_ticks++;
+      SoftSerial_Handler();
+    }
+    // a timer started by a pin interrupt first fires one period later
+    for (uint8_t i = 0; i < ss_edges_attached; i++) {
+      if (!ss_edge[i].handler) continue;
+      uint8_t level = gpio_get(ss_edge[i].pin);
+      bool edge = level != ss_edge[i].level && (ss_edge[i].edge == SS_EDGE_CHANGE || level == ss_edge[i].edge);
+      ss_edge[i].level = level;
+      if (edge && ss_edge[i].enabled) ss_edge[i].handler();
+    }
+    for (; ss_wave && ss_wave_next_ps <= ss_time_ps; ss_wave_next_ps += ss_wave_ps) {
+      ss_wave_t w = ss_wave[ss_wave_pos];
+      *ss_wave_port = (*ss_wave_port | (uint32_t)w) & ~(uint32_t)(w >> 32);
+      if (++ss_wave_pos == ss_wave_len) ss_wave_pos = 0;
+      if (ss_wave_pos == ss_wave_len / 2) SoftSerial_DMA_TX_Handler(0);
+      else if (!ss_wave_pos) SoftSerial_DMA_TX_Handler(1);
+    }
+    // samples due in this step see the pins as the hook left them
+    for (; ss_dma_buf && ss_dma_next_ps <= ss_time_ps; ss_dma_next_ps += ss_dma_ps) {
+      ss_dma_buf[ss_dma_pos] = *ss_dma_port;
+      if (++ss_dma_pos == ss_dma_len) ss_dma_pos = 0;
+      if (ss_dma_pos == ss_dma_len / 2 || !ss_dma_pos) SoftSerial_DMA_RX_Handler();
+    }
+  }
+  return n;
+}
+
+uint32_t HAL_softserial_tick_rate() { return ss_tick_rate; }
+uint64_t HAL_softserial_ticks() { return ss_ticks; }
+uint64_t HAL_softserial_time_ns() { return ss_time_ps / 1000; }
+
+#endif
@@ -0,0 +1,116 @@
+/**
+ * FYSETC
+ *
+ * Copyright (c) 2019 SoftwareSerialM [https://github.com/FYSETC/SoftwareSerialM]
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/**
+ * HAL for host builds (Linux)
+ *
+ * Pins are bits of in-memory virtual ports, 32 pins per port, and the timer
+ * is simulated: nothing runs on its own, the host steps the timer interrupt
+ * with HAL_softserial_step() and every step advances the simulated clock by
+ * one timer period (the last one while the timer is stopped). While pin
+ * interrupts are enabled steps are no longer than the shortest timer period
+ * so far, and the timer interrupt runs on the steps its ticks fall in. Pin
+ * interrupts and DMA transfers are checked once per step. HAL_softserial_hold()
+ * delays the timer interrupt, ticks due meanwhile run once when it ends.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+#include <stdint.h>
+
+#define OVERSAMPLE 3
+#define INTERRUPT_PRIORITY 0
+
+#ifndef SS_VIRTUAL_PORTS
+  #define SS_VIRTUAL_PORTS 4
+#endif
+
+#ifndef SS_VIRTUAL_EDGES
+  #define SS_VIRTUAL_EDGES 8    // pins with an attached pin interrupt
+#endif
+
+extern volatile uint32_t HAL_softserial_port[SS_VIRTUAL_PORTS];
+
+// pins outside the virtual ports, such as -1 for none, are ignored and read idle high
+#define gpio_valid(IO)  ((unsigned)(IO) < SS_VIRTUAL_PORTS * 32)
+#define gpio_set(IO,V)  do {                                                          \
+                          if (!gpio_valid(IO)) break;                                 \
+                          if (V) HAL_softserial_port[(IO) >> 5] |= 1UL << ((IO) & 31);    \
+                          else HAL_softserial_port[(IO) >> 5] &= ~(1UL << ((IO) & 31));   \
+                        }while(0)
+#define gpio_get(IO)    (!gpio_valid(IO) || (HAL_softserial_port[(IO) >> 5] & (1UL << ((IO) & 31))) ? HIGH : LOW)
+
+// Direct port access, resolved once per pin by the caller
+typedef volatile uint32_t *ss_port_t;
+#define gpio_port(IO)         (&HAL_softserial_port[(IO) >> 5])
+#define gpio_mask(IO)         (1UL << ((IO) & 31))
+#define gpio_port_set(P,M,V)  do {                          \
+                                if (V) *(P) |= (M);         \
+                                else *(P) &= ~(M);          \
+                              }while(0)
+#define gpio_port_get(P,M)    ((*(P) & (M)) ? HIGH : LOW)
+#define gpio_port_write(P,S,C) (*(P) = (*(P) | (S)) & ~(C))
+#define gpio_port_read(P)     (*(P))
+#define HAL_SS_CONST_PINMAP   1
+
+#define gpio_edge_enable(IO)  HAL_softserial_edge_enable(IO, true)
+#define gpio_edge_disable(IO) HAL_softserial_edge_enable(IO, false)
+#define HAL_SS_EDGE_WAKE 1
+
+void HAL_softserial_edge_enable(int16_t pin, bool enable);
+
+// edges are time stamped with the simulated clock
+#define HAL_SS_EDGE_CAPTURE 1
+#define HAL_softserial_edge_time()  ((uint32_t)HAL_softserial_time_ns())
+#define HAL_softserial_edge_clock() (1000000000UL)
+
+// DMA sampling of a virtual port, at its own rate within the steps
+#define HAL_SS_DMA_RX 1
+typedef uint32_t ss_sample_t;
+
+// and DMA output of set/reset words, pins to set in the low half
+#define HAL_SS_DMA_TX 1
+typedef uint64_t ss_wave_t;
+#define gpio_wave_word(M,V) ((V) ? (ss_wave_t)(M) : (ss_wave_t)(M) << 32)
+
+// The simulated interrupt only runs from HAL_softserial_step(), never concurrently
+#define ss_cli()
+#define ss_sei()
+
+#define HAL_softserial_timer_isr_prologue()
+#define HAL_softserial_timer_isr_epilogue()
+
+// Busy waits in the core spend simulated time, so blocking calls still complete
+#define HAL_softserial_busy_wait() HAL_softserial_step(1)
+
+#define HAL_SOFTSERIAL_TIMER_ISR() extern "C" void SoftSerial_Handler()
+
+extern "C" void SoftSerial_Handler(void);
+
+// Called before every simulated timer tick with the current simulated time,
+// e.g. to drive an RX pin from a waveform or to loop a TX pin back.
+extern void (*HAL_softserial_tick_hook)(uint64_t now_ns);
+
+uint32_t HAL_softserial_step(uint32_t steps);  // returns the number of steps run, 0 while nothing can fire
+uint32_t HAL_softserial_tick_rate();           // current timer interrupt rate in Hz, 0 while stopped
+uint64_t HAL_softserial_ticks();               // timer interrupts run so far
+uint64_t HAL_softserial_time_ns();             // simulated time
+void HAL_softserial_hold(uint32_t ns);         // holds the timer interrupt off, as one of higher priority would
@@ -21,13 +21,13 @@ void HAL_softSerial_init() {
   NVIC_SetPriority(RIT_IRQn, NVIC_EncodePriority(0, INTERRUPT_PRIORITY, 0));
 }
 
-void HAL_softserial_setSpeed(uint32_t speed) {
+void HAL_softserial_setRate(uint32_t rate) {
   NVIC_DisableIRQ(RIT_IRQn);
-  if (speed != 0) {
+  if (rate != 0) {
     uint32_t clock_rate, cmp_value;
     // Get PCLK value of RIT
     clock_rate = CLKPWR_GetPCLK(CLKPWR_PCLKSEL_RIT);
-    cmp_value = clock_rate/(speed*OVERSAMPLE);
+    cmp_value = clock_rate/rate;
     LPC_RIT->RICOMPVAL = cmp_value;
     LPC_RIT->RICOUNTER	= 0x00000000;
     /* Set timer enable clear bit to clear timer to 0 whenever
@@ -2,15 +2,34 @@
 
 #if HAL_SS_PLATFORM == HAL_PLATFORM_SAMD51
 
-#include "HAL_softserial_SAMD51.h"
+#include "HAL_softserial.h"
+
+uint32_t ss_tick_start;   // DWT->CYCCNT at the start of the period the last tick ended
+uint32_t ss_tick_cycles;  // timer period in CPU cycles
 
 void HAL_softSerial_init() {
   NVIC_SetPriority(SS_TIMERIRQ, INTERRUPT_PRIORITY);
+  CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+  DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+// Tick period in timer clocks rounded to the nearest, prescaled (DIV1 to
+// DIV16 as 1 << div) only as far as needed to fit 16 bits
+static uint32_t ss_timer_period(uint32_t rate, uint8_t &div) {
+  uint32_t cycles = (F_CPU + rate / 2) / rate;
+  div = 0;
+  while (div < 4 && cycles > (0x10000UL << div)) div++;
+  return (cycles + (1UL << div >> 1)) >> div;
 }
 
-void HAL_softserial_setSpeed(uint32_t speed) {
+void HAL_softserial_setRate(uint32_t rate) {
   Disable_Irq(SS_TIMERIRQ);
-  if (speed != 0) {
+  if (rate != 0) {
+    uint8_t div;
+    uint32_t cycles = ss_timer_period(rate, div);
+    // a running timer keeps a tick that fell due meanwhile, the reset below clears its flag
+    bool pending = SS_TC_DEV->COUNT16.CTRLA.bit.ENABLE && (SS_TC_DEV->COUNT16.INTFLAG.reg & TC_INTFLAG_OVF);
+
     // Disable timer interrupt
     SS_TC_DEV->COUNT16.INTENCLR.reg = TC_INTENCLR_OVF;  // disable overflow interrupt
 
@@ -31,12 +50,12 @@ void HAL_softserial_setSpeed(uint32_t speed) {
 
     // Wave mode, reset counter on overflow on 0 (I use count down to prevent double buffer use)
     SS_TC_DEV->COUNT16.WAVE.reg = TC_WAVE_WAVEGEN_MFRQ;
-    SS_TC_DEV->COUNT16.CTRLA.reg = TC_CTRLA_MODE_COUNT16 | TC_CTRLA_PRESCALER_DIV1;
+    SS_TC_DEV->COUNT16.CTRLA.reg = TC_CTRLA_MODE_COUNT16 | TC_CTRLA_PRESCALER(div);
     SS_TC_DEV->COUNT16.CTRLBSET.reg = TC_CTRLBCLR_DIR;
     while(SS_TC_DEV->COUNT16.SYNCBUSY.bit.CTRLB) ;
 
-    // Set compare value
-    SS_TC_DEV->COUNT16.COUNT.reg = SS_TC_DEV->COUNT16.CC[0].reg = F_CPU / (speed * OVERSAMPLE);
+    // Set compare value, counting from CC0 down to 0 takes CC0 + 1 clocks
+    SS_TC_DEV->COUNT16.COUNT.reg = SS_TC_DEV->COUNT16.CC[0].reg = cycles - 1;
 
     // Enable interrupt on compare
     SS_TC_DEV->COUNT16.INTFLAG.reg = TC_INTFLAG_OVF;    // reset pending interrupt
@@ -45,10 +64,43 @@ void HAL_softserial_setSpeed(uint32_t speed) {
     // And start timer
     SS_TC_DEV->COUNT16.CTRLA.bit.ENABLE = true;
     while(SS_TC_DEV->COUNT16.SYNCBUSY.bit.ENABLE) ;
+    ss_tick_cycles = cycles << div;
+    ss_tick_start = DWT->CYCCNT - (pending ? ss_tick_cycles : 0);
 
     SS_TC_DEV->COUNT16.INTFLAG.reg = TC_INTFLAG_OVF;
+    if (pending)
+      NVIC_SetPendingIRQ(SS_TIMERIRQ);
+    else
+      NVIC_ClearPendingIRQ(SS_TIMERIRQ);
     NVIC_EnableIRQ(SS_TIMERIRQ);
   }
+  else {
+    // idle until the next rate
+    SS_TC_DEV->COUNT16.CTRLA.bit.ENABLE = false;
+    while(SS_TC_DEV->COUNT16.SYNCBUSY.bit.ENABLE) ;
+  }
+}
+
+uint64_t HAL_softserial_tick_time(uint32_t rate) {
+  uint8_t div;
+  uint32_t cycles = ss_timer_period(rate, div);
+  return ((uint64_t)cycles << div) * 1000000000000ULL / F_CPU;
+}
+
+uint32_t HAL_softserial_tick_elapsed() {
+  // from the cycle counter, reading COUNT would wait for a READSYNC. Periods
+  // of ticks lost to a held off interrupt are still in the count.
+  uint32_t t = (DWT->CYCCNT - ss_tick_start) % ss_tick_cycles;
+  return ((uint64_t)t << 16) / ss_tick_cycles;
+}
+
+void HAL_softserial_edge_attach(int16_t pin, uint8_t edge, void (*handler)()) {
+  attachInterrupt(pin, handler, edge == SS_EDGE_CHANGE ? CHANGE : edge == SS_EDGE_RISING ? RISING : FALLING);
+  gpio_edge_disable(pin);
+}
+
+void HAL_softserial_edge_detach(int16_t pin) {
+  detachInterrupt(pin);
 }
 
 #endif
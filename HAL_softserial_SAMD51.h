@@ -40,6 +40,34 @@
                         }while(0)
 #define gpio_get(IO)  ((digitalPinToPort(IO)->IN.reg & digitalPinToBitMask(IO)) ? HIGH : LOW)
 
+// Direct port access, resolved once per pin by the caller
+typedef PortGroup *ss_port_t;
+#define gpio_port(IO)         digitalPinToPort(IO)
+#define gpio_mask(IO)         digitalPinToBitMask(IO)
+#define gpio_port_set(P,M,V)  do {                                \
+                                if (V) (P)->OUTSET.reg = (M);     \
+                                else (P)->OUTCLR.reg = (M);       \
+                              }while(0)
+#define gpio_port_get(P,M)    (((P)->IN.reg & (M)) ? HIGH : LOW)
+#define gpio_port_write(P,S,C) do {                               \
+                                (P)->OUTSET.reg = (S);            \
+                                (P)->OUTCLR.reg = (C);            \
+                              }while(0)
+#define gpio_port_read(P)     ((P)->IN.reg)
+
+#define gpio_edge_mask(IO)    (1UL << g_APinDescription[IO].ulExtInt)
+#define gpio_edge_enable(IO)  do {                                          \
+                                EIC->INTFLAG.reg = gpio_edge_mask(IO);      \
+                                EIC->INTENSET.reg = gpio_edge_mask(IO);     \
+                              }while(0)
+#define gpio_edge_disable(IO) (EIC->INTENCLR.reg = gpio_edge_mask(IO))
+#define HAL_SS_EDGE_WAKE 1
+
+// the DWT cycle counter time stamps edges
+#define HAL_SS_EDGE_CAPTURE 1
+#define HAL_softserial_edge_time()  (DWT->CYCCNT)
+#define HAL_softserial_edge_clock() (F_CPU)
+
 #define __SS_TIMERIRQ(t)    TC##t##_IRQn
 #define _SS_TIMERIRQ(t)     __SS_TIMERIRQ(t)
 #define SS_TIMERIRQ         _SS_TIMERIRQ(SS_TIMER)
@@ -57,10 +85,16 @@
                           __ISB();            \
                         }while(0)
 
-#define cli()   Disable_Irq(SS_TIMERIRQ)        // Disable timer interrupt
-#define sei()   NVIC_EnableIRQ(SS_TIMERIRQ)     // Enable timer interrupt
+// the start bit handler edits the listeners too, and the EIC has an
+// interrupt per line: mask all of them
+#define ss_cli()   __disable_irq()
+#define ss_sei()   __enable_irq()
+
+// TC and CPU both run from GCLK0: the period starts are kept on the cycle
+// counter, so reading how far the timer counted needs no COUNT sync
+extern uint32_t ss_tick_start, ss_tick_cycles;
 
-#define HAL_softserial_timer_isr_prologue() do{ SS_TC_DEV->COUNT16.INTFLAG.reg = TC_INTFLAG_OVF; } while(0)
+#define HAL_softserial_timer_isr_prologue() do{ SS_TC_DEV->COUNT16.INTFLAG.reg = TC_INTFLAG_OVF; ss_tick_start += ss_tick_cycles; } while(0)
 #define HAL_softserial_timer_isr_epilogue()
 
 #define HAL_SOFTSERIAL_TIMER_ISR() SS_TC_HANDLER(SS_TIMER)
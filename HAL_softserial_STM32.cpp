@@ -24,39 +24,76 @@
 
 #include <Arduino.h>
 #include <stdint.h>
-#include "HAL_softserial_STM32.h"
+#include "HAL_softserial.h"
 
 #ifdef STM32F0xx
-  #ifndef HAL_TIMER_RATE
-    #define HAL_TIMER_RATE (F_CPU)
-  #endif
-  
   #ifndef SS_TIMER
     #define SS_TIMER 4
   #endif
 
 #elif defined(STM32F1xx)
-  #ifndef HAL_TIMER_RATE
-    #define HAL_TIMER_RATE (F_CPU)
-  #endif
-
   #ifndef SS_TIMER
     #define SS_TIMER 3
   #endif
 
 #elif defined(STM32F4xx) || defined(STM32F7xx)
-
-  #ifndef HAL_TIMER_RATE
-    #define HAL_TIMER_RATE (F_CPU/2)
-  #endif
-
   #ifndef SS_TIMER
     #define SS_TIMER 9
   #endif
 
 #endif
 
-#define SS_TIMER_RATE 1000000 //1MHz
+//
+// DMA sampling of the RX port and DMA output of the TX waveform: the update
+// event of a spare timer requests one transfer from the IDR, or to the BSRR,
+// per sample or bit. The buffers are not cache maintained: on F7 with the
+// D-cache enabled they must be in memory it does not cover, such as DTCM.
+//
+#if defined(STM32F1xx)
+  #if HAL_SS_DMA_RX && !defined(SS_DMA_RX_TIMER)
+    #define SS_DMA_RX_TIMER   2               // TIM2_UP -> DMA1 channel 2
+    #define SS_DMA_RX_CHANNEL DMA1_Channel2
+    #define SS_DMA_RX_IRQ     DMA1_Channel2_IRQn
+    #define SS_DMA_RX_IRQHandler DMA1_Channel2_IRQHandler
+    #define SS_DMA_RX_FLAGS_CLEAR() (DMA1->IFCR = DMA_IFCR_CGIF2)
+  #endif
+  #if HAL_SS_DMA_TX && !defined(SS_DMA_TX_TIMER)
+    #define SS_DMA_TX_TIMER   4               // TIM4_UP -> DMA1 channel 7
+    #define SS_DMA_TX_CHANNEL DMA1_Channel7
+    #define SS_DMA_TX_IRQ     DMA1_Channel7_IRQn
+    #define SS_DMA_TX_IRQHandler DMA1_Channel7_IRQHandler
+    #define SS_DMA_TX_FLAGS() (DMA1->ISR & (DMA_ISR_HTIF7 | DMA_ISR_TCIF7))
+    #define SS_DMA_TX_FLAGS_CLEAR() (DMA1->IFCR = DMA_IFCR_CGIF7)
+    #define SS_DMA_TX_HALF_FLAG DMA_ISR_HTIF7
+  #endif
+  #define SS_DMA_CLK_ENABLE() __HAL_RCC_DMA1_CLK_ENABLE()
+#else
+  // only DMA2 reaches the GPIO ports
+  #if HAL_SS_DMA_RX && !defined(SS_DMA_RX_TIMER)
+    #define SS_DMA_RX_TIMER   8               // TIM8_UP -> DMA2 stream 1 channel 7
+    #define SS_DMA_RX_STREAM  DMA2_Stream1
+    #define SS_DMA_RX_REQUEST 7
+    #define SS_DMA_RX_IRQ     DMA2_Stream1_IRQn
+    #define SS_DMA_RX_IRQHandler DMA2_Stream1_IRQHandler
+    #define SS_DMA_RX_FLAGS_CLEAR() (DMA2->LIFCR = DMA_LIFCR_CTCIF1 | DMA_LIFCR_CHTIF1 | DMA_LIFCR_CTEIF1 | DMA_LIFCR_CDMEIF1 | DMA_LIFCR_CFEIF1)
+  #endif
+  #if HAL_SS_DMA_TX && !defined(SS_DMA_TX_TIMER)
+    #define SS_DMA_TX_TIMER   1               // TIM1_UP -> DMA2 stream 5 channel 6
+    #define SS_DMA_TX_STREAM  DMA2_Stream5
+    #define SS_DMA_TX_REQUEST 6
+    #define SS_DMA_TX_IRQ     DMA2_Stream5_IRQn
+    #define SS_DMA_TX_IRQHandler DMA2_Stream5_IRQHandler
+    #define SS_DMA_TX_FLAGS() (DMA2->HISR & (DMA_HISR_HTIF5 | DMA_HISR_TCIF5))
+    #define SS_DMA_TX_FLAGS_CLEAR() (DMA2->HIFCR = DMA_HIFCR_CTCIF5 | DMA_HIFCR_CHTIF5 | DMA_HIFCR_CTEIF5 | DMA_HIFCR_CDMEIF5 | DMA_HIFCR_CFEIF5)
+    #define SS_DMA_TX_HALF_FLAG DMA_HISR_HTIF5
+  #endif
+  #define SS_DMA_CLK_ENABLE() __HAL_RCC_DMA2_CLK_ENABLE()
+#endif
+
+#define __SS_TIM_DEV(X) TIM##X
+#define _SS_TIM_DEV(X) __SS_TIM_DEV(X)
+#define __SS_TIM_CLK_ENABLE(X) __HAL_RCC_TIM##X##_CLK_ENABLE()
+#define _SS_TIM_CLK_ENABLE(X) __SS_TIM_CLK_ENABLE(X)
 
 #define __SS_TIMER_DEV(X) TIM##X
 #define _SS_TIMER_DEV(X) __SS_TIMER_DEV(X)
@@ -68,26 +105,246 @@
 
 stimer_t SSTimerHandle;
 
-void HAL_softSerial_init() {      
-  uint32_t prescaler = (HAL_TIMER_RATE / SS_TIMER_RATE) - 1;
-  
+// Timers count at the clock of their APB bus, twice that when the bus is
+// prescaled. The core's getTimerClkFreq() reads it from the RCC setup, so
+// it follows the clock tree of the board rather than a fraction of F_CPU.
+// HAL_TIMER_RATE and SS_DMA_TIMER_RATE override it for the softserial timer
+// and the DMA timers.
+#ifdef HAL_TIMER_RATE
+  #define ss_tim_clock(T) (HAL_TIMER_RATE)
+#else
+  #define ss_tim_clock(T) getTimerClkFreq(T)
+#endif
+#ifdef SS_DMA_TIMER_RATE
+  #define ss_dma_tim_clock(T) (SS_DMA_TIMER_RATE)
+#else
+  #define ss_dma_tim_clock(T) getTimerClkFreq(T)
+#endif
+
+static uint32_t ss_timer_clock;  // of SS_TIMER, set by HAL_softSerial_init()
+
+// Period of clock/rate timer clocks rounded to the nearest, in prescaled
+// clocks. 16 bit timers: prescale only when the period does not fit, so the
+// period keeps the full resolution of the timer clock.
+static uint32_t ss_timer_period(uint32_t clock, uint32_t rate, uint32_t &prescaler) {
+  uint32_t cycles = (clock + rate / 2) / rate;
+  prescaler = (cycles - 1) >> 16;
+  return (cycles + (prescaler + 1) / 2) / (prescaler + 1);
+}
+
+// Set tim to one update every clock/rate timer clocks
+static void ss_timer_set_rate(TIM_TypeDef *tim, uint32_t clock, uint32_t rate) {
+  uint32_t prescaler, period = ss_timer_period(clock, rate, prescaler);
+  tim->PSC = prescaler;
+  tim->ARR = period - 1;
+  tim->EGR = TIM_EGR_UG;  // load PSC now, not at the next update
+}
+
+// Unprescaled tick periods are floor(clock/rate) timer clocks, one more on
+// rem of every rate ticks: the error accumulates to at most one clock and
+// the average tick rate is exact.
+static uint32_t ss_tick_arr, ss_tick_rem, ss_tick_div, ss_tick_acc;
+
+void HAL_softserial_tick_adjust() {
+  if (ss_tick_rem) {
+    uint32_t arr = ss_tick_arr;
+    if ((ss_tick_acc += ss_tick_rem) >= ss_tick_div) {
+      ss_tick_acc -= ss_tick_div;
+      arr++;
+    }
+    SS_TIMER_DEV->ARR = arr;  // preloaded, sets the period after this one
+  }
+}
+
+void HAL_softSerial_init() {
   SSTimerHandle.timer = SS_TIMER_DEV;
   SSTimerHandle.irqHandle = SoftSerial_Handler;
-  TimerHandleInit(&SSTimerHandle, 0, prescaler);
+  TimerHandleInit(&SSTimerHandle, 0, 0);
+  ss_timer_clock = ss_tim_clock(SS_TIMER_DEV);
   NVIC_SetPriority(SS_TIMER_IRQ, NVIC_EncodePriority(0, INTERRUPT_PRIORITY, 0));
+
+  #if HAL_SS_EDGE_CAPTURE
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    #ifdef STM32F7xx
+      DWT->LAR = 0xC5ACCE55;  // unlock
+    #endif
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+  #endif
 }
 
-void HAL_softserial_setSpeed(uint32_t speed) {
+void HAL_softserial_setRate(uint32_t rate) {
   NVIC_DisableIRQ(SS_TIMER_IRQ);
-  if (speed != 0) {
-    uint32_t period  = (SS_TIMER_RATE / (speed*OVERSAMPLE)) - 1;
-    
-    SS_TIMER_DEV->ARR = period;
+  if (rate != 0) {
+    bool running = SS_TIMER_DEV->CR1 & TIM_CR1_CEN;
+    // only overflows flag an update, not the UG loading the new rate
+    SS_TIMER_DEV->CR1 |= TIM_CR1_ARPE | TIM_CR1_URS;
+    ss_timer_set_rate(SS_TIMER_DEV, ss_timer_clock, rate);
+    ss_tick_rem = SS_TIMER_DEV->PSC ? 0 : ss_timer_clock % rate;
+    ss_tick_arr = ss_timer_clock / rate - 1;
+    ss_tick_div = rate;
+    ss_tick_acc = 0;
     SS_TIMER_DEV->CNT = 0;
-    SS_TIMER_DEV->CR1 |= 0x01;
+    if (!running) {
+      // drop an update left pending while stopped, the first tick is one
+      // period away. A running timer keeps a tick that fell due meanwhile.
+      SS_TIMER_DEV->SR = ~TIM_SR_UIF;
+      NVIC_ClearPendingIRQ(SS_TIMER_IRQ);
+    }
+    SS_TIMER_DEV->CR1 |= TIM_CR1_CEN;
     NVIC_EnableIRQ(SS_TIMER_IRQ);
   }
+  else
+    SS_TIMER_DEV->CR1 &= ~TIM_CR1_CEN;  // idle until the next rate
+}
+
+uint64_t HAL_softserial_tick_time(uint32_t rate) {
+  uint32_t prescaler, period = ss_timer_period(ss_timer_clock, rate, prescaler);
+  // unprescaled, HAL_softserial_tick_adjust() keeps the average exact
+  if (!prescaler) return (1000000000000ULL + rate / 2) / rate;
+  return (uint64_t)period * (prescaler + 1) * 1000000000000ULL / ss_timer_clock;
+}
+
+uint32_t HAL_softserial_tick_elapsed() {
+  return (SS_TIMER_DEV->CNT << 16) / (SS_TIMER_DEV->ARR + 1);
+}
+
+void HAL_softserial_edge_attach(int16_t pin, uint8_t edge, void (*handler)()) {
+  attachInterrupt(digitalPinToInterrupt(pin), handler, edge == SS_EDGE_CHANGE ? CHANGE : edge == SS_EDGE_RISING ? RISING : FALLING);
+  gpio_edge_disable(pin);
 }
 
+void HAL_softserial_edge_detach(int16_t pin) {
+  detachInterrupt(digitalPinToInterrupt(pin));
+}
+
+#if HAL_SS_DMA_RX || HAL_SS_DMA_TX
+
+// Run tim with one update event, and so one DMA request, at rate Hz
+static void ss_dma_timer_start(TIM_TypeDef *tim, uint32_t rate) {
+  tim->CR1 = 0;
+  ss_timer_set_rate(tim, ss_dma_tim_clock(tim), rate);  // before requests are enabled
+  tim->SR = 0;
+  tim->DIER = TIM_DIER_UDE;
+  tim->CR1 = TIM_CR1_CEN;
+}
+
+static void ss_dma_timer_stop(TIM_TypeDef *tim) {
+  tim->CR1 = 0;
+  tim->DIER = 0;
+}
+
+static void ss_dma_irq_enable(IRQn_Type irq) {
+  NVIC_SetPriority(irq, NVIC_EncodePriority(0, INTERRUPT_PRIORITY, 0));
+  NVIC_ClearPendingIRQ(irq);
+  NVIC_EnableIRQ(irq);
+}
+
+#endif
+
+#if HAL_SS_DMA_RX
+
+static uint16_t ss_dma_rx_len;
+
+void HAL_softserial_dma_rx_start(ss_port_t port, uint32_t rate, volatile ss_sample_t *buf, uint16_t len) {
+  _SS_TIM_CLK_ENABLE(SS_DMA_RX_TIMER);
+  SS_DMA_CLK_ENABLE();
+  HAL_softserial_dma_rx_stop();
+
+  ss_dma_rx_len = len;
+  SS_DMA_RX_FLAGS_CLEAR();
+  #if defined(STM32F1xx)
+    // word reads of the IDR, the low half word is stored
+    SS_DMA_RX_CHANNEL->CPAR = (uint32_t)&port->IDR;
+    SS_DMA_RX_CHANNEL->CMAR = (uint32_t)buf;
+    SS_DMA_RX_CHANNEL->CNDTR = len;
+    SS_DMA_RX_CHANNEL->CCR = DMA_CCR_PL_1 | DMA_CCR_MSIZE_0 | DMA_CCR_PSIZE_1 | DMA_CCR_MINC | DMA_CCR_CIRC
+                           | DMA_CCR_HTIE | DMA_CCR_TCIE | DMA_CCR_EN;
+  #else
+    // direct mode, half word reads of the IDR
+    SS_DMA_RX_STREAM->PAR = (uint32_t)&port->IDR;
+    SS_DMA_RX_STREAM->M0AR = (uint32_t)buf;
+    SS_DMA_RX_STREAM->NDTR = len;
+    SS_DMA_RX_STREAM->FCR = 0;
+    SS_DMA_RX_STREAM->CR = (SS_DMA_RX_REQUEST << DMA_SxCR_CHSEL_Pos) | DMA_SxCR_PL_1 | DMA_SxCR_MSIZE_0 | DMA_SxCR_PSIZE_0
+                         | DMA_SxCR_MINC | DMA_SxCR_CIRC | DMA_SxCR_HTIE | DMA_SxCR_TCIE | DMA_SxCR_EN;
+  #endif
+  ss_dma_irq_enable(SS_DMA_RX_IRQ);
+  ss_dma_timer_start(_SS_TIM_DEV(SS_DMA_RX_TIMER), rate);
+}
+
+void HAL_softserial_dma_rx_stop() {
+  ss_dma_timer_stop(_SS_TIM_DEV(SS_DMA_RX_TIMER));
+  NVIC_DisableIRQ(SS_DMA_RX_IRQ);
+  #if defined(STM32F1xx)
+    SS_DMA_RX_CHANNEL->CCR = 0;
+  #else
+    SS_DMA_RX_STREAM->CR = 0;
+    while (SS_DMA_RX_STREAM->CR & DMA_SxCR_EN) ;
+  #endif
+}
+
+uint16_t HAL_softserial_dma_rx_pos() {
+  #if defined(STM32F1xx)
+    uint16_t left = SS_DMA_RX_CHANNEL->CNDTR;
+  #else
+    uint16_t left = SS_DMA_RX_STREAM->NDTR;
+  #endif
+  return left == ss_dma_rx_len ? 0 : ss_dma_rx_len - left;
+}
+
+extern "C" void SS_DMA_RX_IRQHandler() {
+  SS_DMA_RX_FLAGS_CLEAR();
+  SoftSerial_DMA_RX_Handler();
+}
+
+#endif
+
+#if HAL_SS_DMA_TX
+
+void HAL_softserial_dma_tx_start(ss_port_t port, uint32_t rate, const volatile ss_wave_t *wave, uint16_t len) {
+  _SS_TIM_CLK_ENABLE(SS_DMA_TX_TIMER);
+  SS_DMA_CLK_ENABLE();
+  HAL_softserial_dma_tx_stop();
+
+  SS_DMA_TX_FLAGS_CLEAR();
+  #if defined(STM32F1xx)
+    SS_DMA_TX_CHANNEL->CPAR = (uint32_t)&port->BSRR;
+    SS_DMA_TX_CHANNEL->CMAR = (uint32_t)wave;
+    SS_DMA_TX_CHANNEL->CNDTR = len;
+    SS_DMA_TX_CHANNEL->CCR = DMA_CCR_PL_1 | DMA_CCR_MSIZE_1 | DMA_CCR_PSIZE_1 | DMA_CCR_MINC | DMA_CCR_CIRC
+                           | DMA_CCR_DIR | DMA_CCR_HTIE | DMA_CCR_TCIE | DMA_CCR_EN;
+  #else
+    SS_DMA_TX_STREAM->PAR = (uint32_t)&port->BSRR;
+    SS_DMA_TX_STREAM->M0AR = (uint32_t)wave;
+    SS_DMA_TX_STREAM->NDTR = len;
+    SS_DMA_TX_STREAM->FCR = 0;
+    SS_DMA_TX_STREAM->CR = (SS_DMA_TX_REQUEST << DMA_SxCR_CHSEL_Pos) | DMA_SxCR_PL_1 | DMA_SxCR_MSIZE_1 | DMA_SxCR_PSIZE_1
+                         | DMA_SxCR_MINC | DMA_SxCR_CIRC | DMA_SxCR_DIR_0 | DMA_SxCR_HTIE | DMA_SxCR_TCIE | DMA_SxCR_EN;
+  #endif
+  ss_dma_irq_enable(SS_DMA_TX_IRQ);
+  ss_dma_timer_start(_SS_TIM_DEV(SS_DMA_TX_TIMER), rate);
+}
+
+void HAL_softserial_dma_tx_stop() {
+  ss_dma_timer_stop(_SS_TIM_DEV(SS_DMA_TX_TIMER));
+  NVIC_DisableIRQ(SS_DMA_TX_IRQ);
+  #if defined(STM32F1xx)
+    SS_DMA_TX_CHANNEL->CCR = 0;
+  #else
+    SS_DMA_TX_STREAM->CR = 0;
+    while (SS_DMA_TX_STREAM->CR & DMA_SxCR_EN) ;
+  #endif
+}
+
+extern "C" void SS_DMA_TX_IRQHandler() {
+  uint32_t flags = SS_DMA_TX_FLAGS();
+  SS_DMA_TX_FLAGS_CLEAR();
+  // both set when late: the first half went out before the second
+  if (flags & SS_DMA_TX_HALF_FLAG) SoftSerial_DMA_TX_Handler(0);
+  if (flags & ~SS_DMA_TX_HALF_FLAG) SoftSerial_DMA_TX_Handler(1);
+}
+
+#endif
+
 #endif
 
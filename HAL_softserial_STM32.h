@@ -26,12 +26,68 @@
 #define gpio_set(IO,V)  digitalWrite(IO, V)
 #define gpio_get(IO)    digitalRead(IO)
 
-#define cli() __disable_irq()
-#define sei() __enable_irq()
+// Direct port access, resolved once per pin by the caller
+typedef GPIO_TypeDef *ss_port_t;
+#define gpio_port(IO)         digitalPinToPort(IO)
+#define gpio_mask(IO)         digitalPinToBitMask(IO)
+#define gpio_port_set(P,M,V)  ((P)->BSRR = (V) ? (uint32_t)(M) : (uint32_t)(M) << 16)
+#define gpio_port_get(P,M)    (((P)->IDR & (M)) ? HIGH : LOW)
+#define gpio_port_write(P,S,C) ((P)->BSRR = (uint32_t)(S) | (uint32_t)(C) << 16)
+#define gpio_port_read(P)     ((P)->IDR)
 
-#define HAL_softserial_timer_isr_prologue()
+// EXTI line n serves pin n of the port. The registers differ by family,
+// others have no edge wake.
+#if defined(STM32F0xx) || defined(STM32F1xx) || defined(STM32F2xx) || defined(STM32F3xx) || \
+    defined(STM32F4xx) || defined(STM32F7xx) || defined(STM32L0xx) || defined(STM32L1xx)
+  #define gpio_edge_enable(IO)  do { EXTI->PR = gpio_mask(IO); EXTI->IMR |= gpio_mask(IO); }while(0)
+  #define gpio_edge_disable(IO) (EXTI->IMR &= ~gpio_mask(IO))
+#elif defined(STM32L4xx) || defined(STM32G4xx) || defined(STM32WBxx)
+  #define gpio_edge_enable(IO)  do { EXTI->PR1 = gpio_mask(IO); EXTI->IMR1 |= gpio_mask(IO); }while(0)
+  #define gpio_edge_disable(IO) (EXTI->IMR1 &= ~gpio_mask(IO))
+#elif defined(STM32C0xx) || defined(STM32G0xx) || defined(STM32H5xx) || defined(STM32L5xx) || defined(STM32U5xx)
+  // rising and falling edges pend apart
+  #define gpio_edge_enable(IO)  do {                            \
+                                  EXTI->RPR1 = gpio_mask(IO);   \
+                                  EXTI->FPR1 = gpio_mask(IO);   \
+                                  EXTI->IMR1 |= gpio_mask(IO);  \
+                                }while(0)
+  #define gpio_edge_disable(IO) (EXTI->IMR1 &= ~gpio_mask(IO))
+#elif defined(STM32H7xx)
+  // the Cortex-M7 core's EXTI lines
+  #define gpio_edge_enable(IO)  do { EXTI_D1->PR1 = gpio_mask(IO); EXTI_D1->IMR1 |= gpio_mask(IO); }while(0)
+  #define gpio_edge_disable(IO) (EXTI_D1->IMR1 &= ~gpio_mask(IO))
+#endif
+#ifdef gpio_edge_enable
+  #define HAL_SS_EDGE_WAKE 1
+#endif
+
+#ifdef DWT
+  // the DWT cycle counter time stamps edges, Cortex-M0 parts have none
+  #define HAL_SS_EDGE_CAPTURE 1
+  #define HAL_softserial_edge_time()  (DWT->CYCCNT)
+  #define HAL_softserial_edge_clock() (SystemCoreClock)
+#endif
+
+#if defined(STM32F1xx) || defined(STM32F4xx) || defined(STM32F7xx)
+  // a spare timer's update event makes DMA copy the IDR of the RX port
+  #define HAL_SS_DMA_RX 1
+  typedef uint16_t ss_sample_t;
+
+  // and another one's makes DMA write BSRR words of the TX waveform
+  #define HAL_SS_DMA_TX 1
+  typedef uint32_t ss_wave_t;
+  #define gpio_wave_word(M,V) ((V) ? (ss_wave_t)(M) : (ss_wave_t)(M) << 16)
+#endif
+
+#define ss_cli() __disable_irq()
+#define ss_sei() __enable_irq()
+
+// spreads the fraction of a timer clock in the tick period over the ticks
+#define HAL_softserial_timer_isr_prologue() HAL_softserial_tick_adjust()
 #define HAL_softserial_timer_isr_epilogue()
 
+void HAL_softserial_tick_adjust();
+
 #define HAL_SOFTSERIAL_TIMER_ISR() extern "C" void SoftSerial_Handler(stimer_t *htim)
 
 extern "C" void SoftSerial_Handler(stimer_t *htim);
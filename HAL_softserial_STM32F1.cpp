@@ -25,7 +25,8 @@
 
 #if HAL_SS_PLATFORM == HAL_PLATFORM_STM32F1
 
-#include "HAL_softserial_STM32F1.h"
+#include <Arduino.h>
+#include "HAL_softserial.h"
 
 #ifdef STM32_HIGH_DENSITY
 // define default timer
@@ -54,23 +55,45 @@
 
 void HAL_softSerial_init() {
   ss_timer->attachInterrupt(SS_TIMER_CHANNEL,SoftSerial_Handler); // attach corresponding handler routine    
+  SS_DEMCR |= 1UL << 24;    // TRCENA
+  SS_DWT_CTRL |= 1UL;       // CYCCNTENA
 }
 
-//#define MAX_RELOAD ((1 << 16) - 1)
-uint32_t HAL_softserial_setSpeed(uint32_t speed) {
+// Tick period in prescaled timer clocks rounded to the nearest, setPeriod()
+// truncates to whole microseconds. Prescale only when it does not fit 16 bits.
+static uint32_t ss_timer_period(uint32_t rate, uint32_t &prescaler) {
+  uint32_t period_cyc = (F_CPU + rate / 2) / rate;
+  prescaler = (period_cyc - 1) / 65536 + 1;
+  return (period_cyc + prescaler / 2) / prescaler;
+}
+
+void HAL_softserial_setRate(uint32_t rate) {
   ss_timer->pause();
   ss_timer->setCount(0);
-  if (speed != 0) {
-    // TODO:it may need more accurate calculation.Especially when using higher baudrate.
-    ss_timer->setPeriod(1000000ul/(speed*OVERSAMPLE));
-    //uint32 period_cyc = microseconds * CYCLES_PER_MICROSECOND;
-    //uint16 prescaler = (uint16)(period_cyc / MAX_RELOAD + 1);
-    //uint16 overflow = (uint16)((period_cyc + (prescaler / 2)) / prescaler);
-    //ss_timer->setPrescaleFactor(prescaler);
-    //ss_timer->setOverflow(overflow);
+  if (rate != 0) {
+    uint32_t prescaler, period = ss_timer_period(rate, prescaler);
+    ss_timer->setPrescaleFactor(prescaler);
+    ss_timer->setOverflow(period - 1);  // counts 0 to overflow
     ss_timer->refresh(); // Refresh the timer    
     ss_timer->resume();  // Start the timer counting
   }      
-  return speed;
+}
+
+uint64_t HAL_softserial_tick_time(uint32_t rate) {
+  uint32_t prescaler, period = ss_timer_period(rate, prescaler);
+  return (uint64_t)period * prescaler * 1000000000000ULL / F_CPU;
+}
+
+uint32_t HAL_softserial_tick_elapsed() {
+  return ((uint32_t)ss_timer->getCount() << 16) / ((uint32_t)ss_timer->getOverflow() + 1);
+}
+
+void HAL_softserial_edge_attach(int16_t pin, uint8_t edge, void (*handler)()) {
+  attachInterrupt(pin, handler, edge == SS_EDGE_CHANGE ? CHANGE : edge == SS_EDGE_RISING ? RISING : FALLING);
+  gpio_edge_disable(pin);
+}
+
+void HAL_softserial_edge_detach(int16_t pin) {
+  detachInterrupt(pin);
 }
 #endif
@@ -33,8 +33,31 @@
 #define gpio_set(IO,V) (PIN_MAP[IO].gpio_device->regs->BSRR = (1U << PIN_MAP[IO].gpio_bit) << ((V) ? 0 : 16))
 #define gpio_get(IO) (PIN_MAP[IO].gpio_device->regs->IDR & (1U << PIN_MAP[IO].gpio_bit) ? HIGH : LOW)
 
-#define cli() noInterrupts()  // Disable interrupts  
-#define sei() interrupts()    // Enable interrupts
+// Direct port access, resolved once per pin by the caller
+typedef gpio_reg_map *ss_port_t;
+#define gpio_port(IO)         (PIN_MAP[IO].gpio_device->regs)
+#define gpio_mask(IO)         (1U << PIN_MAP[IO].gpio_bit)
+#define gpio_port_set(P,M,V)  ((P)->BSRR = (M) << ((V) ? 0 : 16))
+#define gpio_port_get(P,M)    (((P)->IDR & (M)) ? HIGH : LOW)
+#define gpio_port_write(P,S,C) ((P)->BSRR = (uint32_t)(S) | (uint32_t)(C) << 16)
+#define gpio_port_read(P)     ((P)->IDR)
+
+// EXTI line n serves pin n of the port
+#define gpio_edge_enable(IO)  do { EXTI_BASE->PR = gpio_mask(IO); EXTI_BASE->IMR |= gpio_mask(IO); }while(0)
+#define gpio_edge_disable(IO) (EXTI_BASE->IMR &= ~gpio_mask(IO))
+#define HAL_SS_EDGE_WAKE 1
+
+// the DWT cycle counter time stamps edges, libmaple has no CMSIS core header
+#define SS_DEMCR    (*(volatile uint32_t *)0xE000EDFC)
+#define SS_DWT_CTRL (*(volatile uint32_t *)0xE0001000)
+#define SS_DWT_CNT  (*(volatile uint32_t *)0xE0001004)
+
+#define HAL_SS_EDGE_CAPTURE 1
+#define HAL_softserial_edge_time()  (SS_DWT_CNT)
+#define HAL_softserial_edge_clock() (F_CPU)
+
+#define ss_cli() noInterrupts()  // Disable interrupts  
+#define ss_sei() interrupts()    // Enable interrupts
 
 #define HAL_softserial_timer_isr_prologue()
 #define HAL_softserial_timer_isr_epilogue()
@@ -35,6 +35,7 @@
 //
 #include <stdint.h>
 #include <stdarg.h>
+#include <string.h>
 #include <Arduino.h>
 #include "SoftwareSerial.h"
 #include "HAL_softserial.h"
@@ -45,60 +46,150 @@
 // Statics
 //
 bool SoftwareSerial::initialised = false;
-SoftwareSerial * SoftwareSerial::active_listener = NULL;
+SoftwareSerial *SoftwareSerial::listeners[_SS_MAX_LISTENERS];
+volatile uint8_t SoftwareSerial::listener_cnt = 0;
 SoftwareSerial * volatile SoftwareSerial::active_out = NULL;
-SoftwareSerial * volatile SoftwareSerial:: active_in = NULL;
-int32_t SoftwareSerial::tx_tick_cnt = 0;
-int32_t SoftwareSerial::rx_tick_cnt = 0;
+SoftwareSerial * volatile SoftwareSerial::dma_out = NULL;
 uint32_t SoftwareSerial::tx_buffer = 0;
 int32_t SoftwareSerial::tx_bit_cnt = 0;
-uint32_t SoftwareSerial::rx_buffer = 0;
-int32_t SoftwareSerial::rx_bit_cnt = -1;
-uint32_t SoftwareSerial::cur_speed = 0;
+uint32_t SoftwareSerial::rx_sample = 0;
+uint16_t SoftwareSerial::rx_sample_pos = 0;
+uint8_t SoftwareSerial::tx_wave_data = 0;
+uint32_t SoftwareSerial::cur_rate = 0;
+uint32_t SoftwareSerial::tx_phase = 0;
+uint32_t SoftwareSerial::tick_due = 0;
+uint32_t SoftwareSerial::tick_clocks = 0;
+uint32_t SoftwareSerial::tick_rest = 0;
+uint32_t SoftwareSerial::tick_frac = 0;
+
+// DMA buffers. DMA does not go through a data cache: with the D-cache of an
+// STM32F7 enabled, the TX waveform written here may not have reached memory
+// when DMA reads it, and RX samples may be read from stale cache lines. Keep
+// them in DTCM RAM or another region the cache does not cover.
+#if HAL_SS_DMA_RX
+  static volatile ss_sample_t rx_samples[_SS_DMA_RX_SAMPLES];
+#endif
+#if HAL_SS_DMA_TX
+  static volatile ss_wave_t tx_wave[_SS_DMA_TX_FRAMES * 10];
+#endif
 
 //
 // Private methods
 //
 
-void SoftwareSerial::setSpeed(uint32_t speed)
-{
-  if (speed != cur_speed) {
-    HAL_softserial_setSpeed(speed);
-    cur_speed = speed;
+// Run the timer for the fastest instance that needs it, the others divide
+// it down with their phase accumulator, and stop it when none does. The
+// transmitter ticks once per bit: on its own the timer runs at its baud
+// rate, along with receivers it asks for its oversampled rate and at least
+// OVERSAMPLE ticks per bit, so that its bits stay within a tick of their
+// place, a fraction of a bit, on a timer the receivers set. Phases are
+// rescaled, with the part of the running tick gone by, so that frames in
+// progress keep their timing.
+// A baud rate tick cannot land in the middle of a bit, so the timer does not
+// slow down before a transmit ends.
+void SoftwareSerial::updateRate() {
+  uint32_t rate = 0;
+  for (uint8_t i = 0; i < listener_cnt; i++)
+    if (listeners[i]->_rx_active && listeners[i]->tickRate() > rate)
+      rate = listeners[i]->tickRate();
+  if (active_out) {
+    uint32_t tx_rate = active_out->txRate(rate);
+    if (tx_rate > rate) rate = tx_rate;
+  }
+  if (rate == cur_rate || (active_out && rate < cur_rate)) return;
+
+  if (rate && cur_rate) {
+    uint32_t elapsed = HAL_softserial_tick_elapsed();
+    for (uint8_t i = 0; i < listener_cnt; i++) {
+      SoftwareSerial *l = listeners[i];
+      l->_rx_phase = ((uint64_t)l->_rx_phase + ((uint64_t)l->tickRate() * elapsed >> 16)) * rate / cur_rate;
+    }
+    if (active_out)
+      tx_phase = ((uint64_t)tx_phase + ((uint64_t)active_out->_speed * elapsed >> 16)) * rate / cur_rate;
   }
+  HAL_softserial_setRate(rate);
+  cur_rate = rate;
+  #if HAL_SS_EDGE_CAPTURE
+    // the timer restarts, its first tick is due one period from now
+    if (rate) {
+      tick_clocks = HAL_softserial_edge_clock() / rate;
+      tick_rest = HAL_softserial_edge_clock() % rate;
+      tick_frac = 0;
+      tick_due = HAL_softserial_edge_time();
+    }
+  #endif
 }
 
-// This function sets the current object as the "listening"
-// one and returns true if it replaces another
+// Start receiving, along with the instances already listening. Returns
+// false if the instance cannot receive on its own, or if _SS_MAX_LISTENERS
+// instances listen already: no listener is made to stop for another, so
+// switching beyond that many takes a stopListening() first.
 bool SoftwareSerial::listen() {
-  if (_receivePin < 0) return false;
+  if (_receivePin < 0 || !_receive_buffer || _rx_grouped) return false;
 
-  // wait for any transmit to complete as we may change speed
-  while(active_out) ;
-  if (active_listener) {
-    active_listener->stopListening();
+  if (_listening) stopListening();
+  if ((_edge_wake || _capture_rx) && !_edge_attached) {
+    if (_capture_rx)
+      HAL_softserial_edge_attach(_receivePin, SS_EDGE_CHANGE, handle_capture_edge);
+    else
+      HAL_softserial_edge_attach(_receivePin, _inverse_logic ? SS_EDGE_RISING : SS_EDGE_FALLING, handle_start_bit);
+    _edge_attached = true;
+    // attaching may have turned a half-duplex line into an input
+    if (_half_duplex) setTX();
   }
-  rx_tick_cnt = 1;
-  rx_bit_cnt = -1;
-  setSpeed(_speed);
-  active_listener = this;
+  #if HAL_SS_EDGE_CAPTURE
+    _capture_bit = HAL_softserial_edge_clock() / _speed;
+  #endif
+  if (!addListener())
+    return false;
   if (!_half_duplex)
-    active_in = this;
+    armStartBit();
+  // polling starts the timer, with edge wake the start bit interrupt does,
+  // capture and DMA sampling need none
+  ss_cli();
+  updateRate();
+  ss_sei();
+  return true;
+}
+
+// Join the listeners. DMA samples one pin, so another DMA listener stops.
+// Returns false, leaving the others listening, when all slots are taken.
+bool SoftwareSerial::addListener() {
+  SoftwareSerial *dma = NULL;
+  for (uint8_t i = 0; i < listener_cnt; i++)
+    if (_dma_rx && listeners[i]->_dma_rx)
+      dma = listeners[i];
+  if (listener_cnt == _SS_MAX_LISTENERS && !dma)
+    return false;
+  if (dma)
+    dma->stopListening();
+
+  ss_cli();
+  listeners[listener_cnt++] = this;
+  _listening = true;
+  ss_sei();
   return true;
 }
 
 // Stop listening. Returns true if we were actually listening.
 bool SoftwareSerial::stopListening() {
-  if (active_listener != this) return false;
+  if (!_listening) return false;
 
-  // wait for any output to complete
-  while (active_out) ;
+  // let our own output complete
+  while (transmitting()) HAL_softserial_busy_wait();
   if (_half_duplex)
     setRXTX(false);
-  active_listener = NULL;
-  active_in = NULL;
-  // turn off interrupts
-  setSpeed(0);
+  else
+    disarmStartBit();
+
+  ss_cli();
+  uint8_t i = 0;
+  while (listeners[i] != this) i++;
+  for (listener_cnt--; i < listener_cnt; i++) listeners[i] = listeners[i + 1];
+  _listening = false;
+  // slow down or turn off the timer unless still needed
+  updateRate();
+  ss_sei();
   return true;
 }
 
@@ -118,101 +209,358 @@ inline void SoftwareSerial::setRX() {
   }
 }
 
-inline void SoftwareSerial::setRXTX(bool input) {
+// Make this instance the active transmitter unless it already is. Output
+// must be queued first: if the handler is still sending our previous bytes
+// it picks up the new ones on its own.
+void SoftwareSerial::startTransmit() {
+  if (_tx_group) {
+    // the group picks up our queue
+    _tx_group->startTransmit();
+    return;
+  }
+  #if HAL_SS_DMA_TX
+    if (_dma_tx) {
+      // the DMA timer runs on its own, the softserial timer is not involved
+      if (dma_out != this) {
+        while (dma_out) HAL_softserial_busy_wait();
+        if (_half_duplex) {
+          ss_cli();
+          setRXTX(false);
+          updateRate();
+          ss_sei();
+        }
+        tx_wave_data = dmaFill(0) | dmaFill(1) << 1;
+        dma_out = this;
+        HAL_softserial_dma_tx_start(_transmitPort, _speed, tx_wave, _SS_DMA_TX_FRAMES * 10);
+      }
+      return;
+    }
+  #endif
+  if (active_out != this) {
+    // wait for another instance's transmit to complete
+    while(active_out) HAL_softserial_busy_wait();
+    // the stop bit state loads the first queued byte on the next tick
+    tx_bit_cnt = 10;
+    if (_half_duplex)
+      setRXTX(false);
+    // make us active before starting the timer, so that a receiver in edge
+    // wake mode finishing its frame does not stop it again
+    ss_cli();
+    tx_phase = 0;
+    active_out = this;
+    updateRate();
+    ss_sei();
+  }
+}
+
+// Switch a half-duplex line between receiving and transmitting. Also called
+// by the interrupt handler for the turnaround after the last byte.
+void SoftwareSerial::setRXTX(bool input) {
   if (_half_duplex) {
     if (input) {
-      if (active_in != this) {
+      if (!_rx_armed) {
         setRX();
-        rx_bit_cnt = -1;
-        rx_tick_cnt = 2;
-        active_in = this;
+        armStartBit();
       }
     }
     else {
-      if (active_in == this) {
+      if (_rx_armed) {
+        disarmStartBit();
         setTX();
-        active_in = NULL;
       }
     }
   }
 }
 
-inline void SoftwareSerial::send() {
-  if (--tx_tick_cnt > 0) return;
-
-  if (tx_bit_cnt++ < 10 ) {
-    // send data (including start and stop bits)
-    gpio_set(_transmitPin, tx_buffer & 1);
-    tx_buffer >>= 1;
-    tx_tick_cnt = OVERSAMPLE;
+// Wait for the next start bit, by polling the line on every tick, by the
+// pin interrupt with edge wake and capture, or in the DMA samples
+void SoftwareSerial::armStartBit() {
+  _rx_bit_cnt = -1;
+  _rx_level = HIGH;
+  _rx_armed = true;
+  if (_edge_wake || _capture_rx)
+    gpio_edge_enable(_receivePin);
+  else if (_dma_rx) {
+    #if HAL_SS_DMA_RX
+      _rx_tick_cnt = 1;
+      rx_sample_pos = 0;
+      HAL_softserial_dma_rx_start(_receivePort, tickRate(), rx_samples, _SS_DMA_RX_SAMPLES);
+    #endif
   }
   else {
-    tx_tick_cnt = 1;
-    if (_output_pending)
-      active_out = NULL;
-    else if (tx_bit_cnt > 10 + OVERSAMPLE*5) {
-      if (_half_duplex && active_listener == this) {
-        pinMode(_receivePin, _inverse_logic ? INPUT_PULLDOWN : INPUT_PULLUP); // pullup for normal logic!
-        rx_bit_cnt = -1;
-        rx_tick_cnt = 2;
-        active_in = this;
-      }
-      active_out = NULL;
-    }
+    _rx_tick_cnt = 2;
+    _rx_phase = 0;
+    _rx_active = true;
   }
 }
 
+void SoftwareSerial::disarmStartBit() {
+  _rx_armed = false;
+  if (_edge_wake || _capture_rx)
+    gpio_edge_disable(_receivePin);
+  #if HAL_SS_DMA_RX
+    if (_dma_rx)
+      HAL_softserial_dma_rx_stop();
+  #endif
+  _rx_active = false;
+}
+
 //
-// The receive routine called by the interrupt handler
+// Interrupt time engine for run time pins
 //
-inline void SoftwareSerial::recv() {
-  if (--rx_tick_cnt > 0) return;
-
-  uint8_t inbit = gpio_get(_receivePin);
-  if (rx_bit_cnt == -1) {
-    // waiting for start bit
-    if (inbit)
-      rx_tick_cnt = 1;
-    else {
-      // got start bit
-      rx_bit_cnt = 0;
-      rx_tick_cnt = OVERSAMPLE + 1;
-      rx_buffer = 0;
+void SoftwareSerial::send() {
+  send_tick<RuntimeIO>();
+}
+
+void SoftwareSerial::recv() {
+  recv_tick<RuntimeIO>();
+}
+
+//
+// Interrupt handling
+//
+
+/* static */
+inline void SoftwareSerial::handle_interrupt() {
+  #if HAL_SS_EDGE_CAPTURE
+    // entered within half a period of when the tick after the last one was
+    // due, as most ticks are: on time. Else how far the timer counted since
+    // the tick tells when it was due, and a tick held off past the next one
+    // by other interrupts was lost. tick_due adds up the rest of the
+    // truncated period too, or its drift would pass for a lost tick.
+    uint32_t now = HAL_softserial_edge_time();
+    tick_due += tick_clocks;
+    if ((tick_frac += tick_rest) >= cur_rate) {
+      tick_frac -= cur_rate;
+      tick_due++;
+    }
+    if ((int32_t)(now - tick_due) > (int32_t)(tick_clocks / 2)) {
+      uint32_t due = now - (uint32_t)((uint64_t)HAL_softserial_tick_elapsed() * tick_clocks >> 16);
+      uint32_t gap = due - (tick_due - tick_clocks);
+      tick_due = due;
+      tick_frac = 0;
+      if (gap > tick_clocks + tick_clocks / 2) {
+        catchUp((gap + tick_clocks / 2) / tick_clocks);
+        return;
+      }
+    }
+  #endif
+
+  // every instance ticks at its own rate, from the phase of the timer
+  for (uint8_t i = 0; i < listener_cnt; i++) {
+    SoftwareSerial *l = listeners[i];
+    if (l->_rx_active && (l->_rx_phase += l->tickRate()) >= cur_rate) {
+      l->_rx_phase -= cur_rate;
+      l->recvTick();
     }
   }
-  else if (rx_bit_cnt < 8) {
-    // data bits
-    rx_buffer >>= 1;
-    if (inbit)
-      rx_buffer |= 0x80;
-    rx_bit_cnt++;
-    rx_tick_cnt = OVERSAMPLE;
+  SoftwareSerial *o = active_out;
+  if (o && (tx_phase += o->_speed) >= cur_rate) {
+    tx_phase -= cur_rate;
+    o->sendTick();
   }
-  else {
-    if (inbit) {
-      // stop bit read complete add to buffer
-      uint8_t next = (_receive_buffer_tail + 1) % _SS_MAX_RX_BUFF;
-      if (next != _receive_buffer_head) {
-        // save new data in buffer: tail points to where byte goes
-        _receive_buffer[_receive_buffer_tail] = rx_buffer; // save new byte
-        _receive_buffer_tail = next;
+}
+
+// Run the ticks lost to a held off interrupt late, all at once, so that the
+// frames in progress keep to the timer's bit grid. Samples are read late but
+// from the right bit while the delay stays under half a bit. Longer delays
+// have lost the frames in flight anyway, only the grid is kept for those.
+void SoftwareSerial::catchUp(uint32_t ticks) {
+  const uint32_t rate = cur_rate;
+  uint32_t run = ticks < 32 ? ticks : 32;
+  for (uint8_t i = 0; i < listener_cnt; i++) {
+    SoftwareSerial *l = listeners[i];
+    if (!l->_rx_active || cur_rate != rate) continue;
+    uint64_t phase = l->_rx_phase + (uint64_t)l->tickRate() * ticks;
+    uint32_t n = phase / rate;
+    l->_rx_phase = phase % rate;
+    if (n > run) n = run;
+    // a listener done with its frame may have stopped or slowed the timer
+    while (n-- && l->_rx_active && cur_rate == rate) l->recvTick();
+  }
+  SoftwareSerial *o = active_out;
+  if (o && cur_rate == rate) {
+    uint64_t phase = tx_phase + (uint64_t)o->_speed * ticks;
+    uint32_t n = phase / rate;
+    tx_phase = phase % rate;
+    if (n > run) n = run;
+    while (n-- && active_out == o) o->sendTick();
+  }
+}
+
+// Start bit edge of a listener in edge wake mode: decode the frame with the
+// timer, which runs only until its stop bit. The handler is shared by all
+// pins, the listener whose idle line went to space level has the edge.
+void SoftwareSerial::handle_start_bit() {
+  for (uint8_t i = 0; i < listener_cnt; i++) {
+    SoftwareSerial *l = listeners[i];
+    if (!l->_edge_wake || !l->_rx_armed || l->_rx_active) continue;
+    if (gpio_port_get(l->_receivePort, l->_receiveMask) ^ l->_inverse_logic) continue;
+
+    gpio_edge_disable(l->_receivePin);
+    // sample the first data bit about one and a half bits after the edge,
+    // if the line is still at space level half a bit after it
+    l->checkStartBit();
+    l->_rx_phase = 0;
+    // the timer interrupt may preempt the pin interrupt
+    ss_cli();
+    l->_rx_active = true;
+    uint32_t rate = cur_rate;
+    updateRate();
+    // a timer already running at our rate ticks anywhere up to a period after
+    // the edge, skip a tick due within half a period
+    if (rate == cur_rate && rate == l->tickRate() && HAL_softserial_tick_elapsed() >= 0x8000)
+      l->_rx_tick_cnt++;
+    ss_sei();
+  }
+}
+
+// Capture decode: frames are rebuilt from the time stamps of the RX pin's
+// edges, so the cost scales with the edges rather than with the baud rate.
+// The handler is shared by all pins, listeners whose level changed have the
+// edge.
+void SoftwareSerial::handle_capture_edge() {
+  #if HAL_SS_EDGE_CAPTURE
+    uint32_t now = HAL_softserial_edge_time();
+    for (uint8_t i = 0; i < listener_cnt; i++) {
+      SoftwareSerial *l = listeners[i];
+      if (!l->_capture_rx || !l->_rx_armed) continue;
+      uint8_t level = gpio_port_get(l->_receivePort, l->_receiveMask) ^ l->_inverse_logic;
+      if (level == l->_rx_level) continue;
+
+      if (l->_rx_bit_cnt >= 0) {
+        // the edge starts the bit nearest to it, the bits before it had the old level
+        uint32_t bit = (now - l->_rx_frame_start + l->_capture_bit / 2) / l->_capture_bit;
+        if (!bit && level) {
+          l->_rx_bit_cnt = -1;  // start bit shorter than half a bit: noise
+          l->_false_starts++;
+        }
+        else
+          l->captureBits(bit, l->_rx_level);
+      }
+      if (l->_rx_bit_cnt < 0 && !level) {
+        // start bit
+        l->_rx_frame_start = now;
+        l->_rx_buffer = 0;
+        l->_rx_bit_cnt = 1;
       }
-      else
-        _buffer_overflow = true;
+      l->_rx_level = level;
     }
-    rx_tick_cnt = 1;
-    rx_bit_cnt = -1;
+  #endif
+}
+
+// Fill the frame bits up to, not including, bit upto with level. Bit 0 is
+// the start bit, 1-8 the data bits and 9 the stop bit.
+void SoftwareSerial::captureBits(uint32_t upto, uint8_t level) {
+  if (upto > 10) upto = 10;
+  for (; _rx_bit_cnt < (int32_t)upto; _rx_bit_cnt++) {
+    if (_rx_bit_cnt < 9) {
+      if (level) _rx_buffer |= 1 << (_rx_bit_cnt - 1);
+    }
+    else if (level)
+      receiveByte(_rx_buffer);
   }
+  if (_rx_bit_cnt >= 10)
+    _rx_bit_cnt = -1;
 }
 
-//
-// Interrupt handling
-//
+// DMA decode: run the receive state machine over the samples taken since
+// the last call, one sample per tick
+void SoftwareSerial::dmaDecode() {
+  #if HAL_SS_DMA_RX
+    uint16_t end = HAL_softserial_dma_rx_pos();
+    while (rx_sample_pos != end) {
+      rx_sample = rx_samples[rx_sample_pos];
+      rx_sample_pos = (rx_sample_pos + 1) & (_SS_DMA_RX_SAMPLES - 1);
+      recv_tick<SampleIO>();
+    }
+  #endif
+}
 
-/* static */
-inline void SoftwareSerial::handle_interrupt() {
-  if (active_in) active_in->recv();
-  if (active_out) active_out->send();
+// Half and full DMA buffer
+void SoftwareSerial::handle_dma_rx() {
+  for (uint8_t i = 0; i < listener_cnt; i++) {
+    SoftwareSerial *l = listeners[i];
+    if (l->_dma_rx && l->_rx_armed) l->dmaDecode();
+  }
+}
+
+#if HAL_SS_DMA_RX
+  extern "C" void SoftSerial_DMA_RX_Handler(void) {
+    SoftwareSerial::handle_dma_rx();
+  }
+#endif
+
+// Fill half of the DMA waveform with the next queued frames. A half the
+// queue does not fill has idle level first and its frames last, so that the
+// last stop bit ends the half and the transfer can stop right there. Returns
+// true if it holds any frame.
+bool SoftwareSerial::dmaFill(uint8_t half) {
+  #if HAL_SS_DMA_TX
+    ss_wave_t mark = gpio_wave_word(_transmitMask, !_inverse_logic),
+              space = gpio_wave_word(_transmitMask, _inverse_logic);
+    volatile ss_wave_t *w = tx_wave + half * (_SS_DMA_TX_FRAMES / 2) * 10;
+    uint16_t head = _transmit_buffer_head,
+             queued = (_transmit_buffer_tail - head) & (_SS_MAX_TX_BUFF - 1);
+    uint8_t f = queued < _SS_DMA_TX_FRAMES / 2 ? _SS_DMA_TX_FRAMES / 2 - queued : 0;
+    for (uint8_t i = 0; i < f * 10; i++)
+      *w++ = mark;
+    for (; f < _SS_DMA_TX_FRAMES / 2; f++) {
+      uint16_t frame = _transmit_buffer[head] << 1 | 0x200;
+      head = (head + 1) & (_SS_MAX_TX_BUFF - 1);
+      for (uint8_t b = 0; b < 10; b++, frame >>= 1)
+        *w++ = (frame & 1) ? mark : space;
+    }
+    _transmit_buffer_head = head;
+    return queued;
+  #else
+    (void)half;
+    return false;
+  #endif
+}
+
+// A half of the DMA waveform has been sent while the other one is going out.
+// Stop once the half going out holds no frame and none is queued: the last
+// stop bit ended the half just sent, so a half-duplex line turns around to
+// receive in time for a reply. Else refill the half just sent.
+void SoftwareSerial::handle_dma_tx(uint8_t half) {
+  SoftwareSerial *o = dma_out;
+  if (!o) return;
+
+  if (!(tx_wave_data & 1 << (half ^ 1)) && o->_transmit_buffer_head == o->_transmit_buffer_tail) {
+    #if HAL_SS_DMA_TX
+      HAL_softserial_dma_tx_stop();
+    #endif
+    if (o->_half_duplex && o->_listening) {
+      o->setRXTX(true);
+      updateRate();
+    }
+    dma_out = NULL;
+  }
+  else if (o->dmaFill(half))
+    tx_wave_data |= 1 << half;
+  else
+    tx_wave_data &= ~(1 << half);
+}
+
+#if HAL_SS_DMA_TX
+  extern "C" void SoftSerial_DMA_TX_Handler(uint8_t half) {
+    SoftwareSerial::handle_dma_tx(half);
+  }
+#endif
+
+// Bring the buffer up to date from the reading side. A capture frame ending
+// in high bits has no edge after its last data bit: complete it once its
+// stop bit is due. DMA samples are decoded without waiting for half a buffer.
+void SoftwareSerial::flushRX() {
+  if (!_listening || !_rx_armed) return;
+  ss_cli();
+  #if HAL_SS_EDGE_CAPTURE
+    if (_capture_rx && _rx_bit_cnt >= 0 && HAL_softserial_edge_time() - _rx_frame_start >= _capture_bit * 19 / 2)
+      captureBits(10, _rx_level);
+  #endif
+  if (_dma_rx) dmaDecode();
+  ss_sei();
 }
 
 HAL_SOFTSERIAL_TIMER_ISR() {
@@ -226,16 +574,65 @@ HAL_SOFTSERIAL_TIMER_ISR() {
 //
 // Constructor
 //
-SoftwareSerial::SoftwareSerial(int16_t receivePin, int16_t transmitPin, bool inverse_logic /* = false */) :
+SoftwareSerial::SoftwareSerial(int16_t receivePin, int16_t transmitPin, bool inverse_logic /* = false */, uint16_t rx_buffer_size /* = _SS_MAX_RX_BUFF */) :
+  SoftwareSerial(receivePin, transmitPin, inverse_logic, NULL, 0) {
+  if (rx_buffer_size) {
+    // 32768 is the largest power of 2 a uint16_t holds, and a ring of 2
+    // the smallest that holds a byte
+    uint16_t size = 2;
+    while (size < rx_buffer_size && size < 0x8000) size <<= 1;
+    _receive_buffer = new unsigned char[size];
+    _receive_buffer_mask = size - 1;
+    _receive_buffer_alloc = true;
+  }
+}
+
+SoftwareSerial::SoftwareSerial(int16_t receivePin, int16_t transmitPin, bool inverse_logic, unsigned char *rx_buffer, uint16_t rx_buffer_size) :
   _receivePin(receivePin),
   _transmitPin(transmitPin),
+  _receivePort(NULL),
+  _transmitPort(NULL),
+  _receiveMask(0),
+  _transmitMask(0),
   _speed(0),
-  _buffer_overflow(false),
+  _oversample(OVERSAMPLE),
+  _vote_ticks(0),
   _inverse_logic(inverse_logic),
   _half_duplex(receivePin == transmitPin),
-  _output_pending(0),
+  _receive_buffer_alloc(false),
+  _edge_wake(false),
+  _capture_rx(false),
+  _dma_rx(false),
+  _dma_tx(false),
+  _edge_attached(false),
+  _listening(false),
+  _rx_grouped(false),
+  _buffer_overflow(false),
+  _rx_noise(false),
+  _rx_armed(false),
+  _rx_active(false),
+  _rx_phase(0),
+  _rx_tick_cnt(0),
+  _rx_bit_cnt(-1),
+  _rx_buffer(0),
+  _rx_level(HIGH),
+  _rx_votes(1),
+  _false_starts(0),
+  _rx_frame_start(0),
+  _capture_bit(0),
+  _receive_buffer(rx_buffer_size > 1 ? rx_buffer : NULL),
+  _receive_buffer_mask(0),
   _receive_buffer_tail(0),
-  _receive_buffer_head(0) {
+  _receive_buffer_head(0),
+  _transmit_buffer_tail(0),
+  _transmit_buffer_head(0),
+  _tx_group(NULL),
+  _virtual_tick(false) {
+  // indices are masked: use the largest power of 2 that fits the buffer.
+  // The ring keeps a slot free, so a single byte holds nothing.
+  while (rx_buffer_size & (rx_buffer_size - 1))
+    rx_buffer_size &= rx_buffer_size - 1;
+  _receive_buffer_mask = rx_buffer_size > 1 ? rx_buffer_size - 1 : 0;
 }
 
 //
@@ -243,6 +640,8 @@ SoftwareSerial::SoftwareSerial(int16_t receivePin, int16_t transmitPin, bool inv
 //
 SoftwareSerial::~SoftwareSerial() {
   end();
+  if (_receive_buffer_alloc)
+    delete[] _receive_buffer;
 }
 
 
@@ -250,7 +649,11 @@ SoftwareSerial::~SoftwareSerial() {
 // Public methods
 //
 
-void SoftwareSerial::begin(long speed) {
+// Set the speed and pins up, and start listening unless half-duplex.
+// Returns false when the instance should receive but cannot listen,
+// because _SS_MAX_LISTENERS instances listen already: the others keep
+// listening, and listen() succeeds once one of them stops.
+bool SoftwareSerial::begin(long speed) {
   #ifdef FORCE_BAUD_RATE
     speed = FORCE_BAUD_RATE;
   #endif
@@ -260,59 +663,274 @@ void SoftwareSerial::begin(long speed) {
     initialised = true;
   }
 
-  // Set output pin as input, to ensure GPIO clock is started before calling setTX().
-  pinMode(_transmitPin, _inverse_logic ? INPUT_PULLDOWN : INPUT_PULLUP);
+  // Resolve port and mask once, so the interrupt handler only does a load or a store
+  if (_receivePin >= 0) {
+    _receivePort = gpio_port(_receivePin);
+    _receiveMask = gpio_mask(_receivePin);
+  }
+  if (_transmitPin >= 0) {
+    _transmitPort = gpio_port(_transmitPin);
+    _transmitMask = gpio_mask(_transmitPin);
+
+    // Set output pin as input, to ensure GPIO clock is started before calling setTX().
+    pinMode(_transmitPin, _inverse_logic ? INPUT_PULLDOWN : INPUT_PULLUP);
 
-  setTX();
+    setTX();
+  }
   if (!_half_duplex) {
     setRX();
+    // listen() also refuses instances that do not receive on their own
+    return listen() || _receivePin < 0 || !_receive_buffer || _rx_grouped;
+  }
+  return true;
+}
+
+// Rate of the timer our bits come from: the one updateRate() asks for us,
+// or the faster one the timer runs at for the other active instances
+uint32_t SoftwareSerial::timerRate() {
+  bool receivers = false;
+  for (uint8_t i = 0; i < listener_cnt; i++)
+    if (listeners[i]->_rx_active) receivers = true;
+  uint32_t rate = _receivePin >= 0 && _receive_buffer ? tickRate() : txRate(receivers);
+  return cur_rate > rate ? cur_rate : rate;
+}
+
+// Bit period the timer realizes for the speed given to begin(), on average,
+// in ns, 0 before begin()
+uint32_t SoftwareSerial::bitPeriod() {
+  if (!_speed) return 0;
+  uint32_t rate = timerRate();
+  return (HAL_softserial_tick_time(rate) * rate / _speed + 500) / 1000;
+}
+
+// Error of the realized bit period against the nominal one, in percent and
+// positive when bits come out long. On a timer that is no multiple of our
+// rate, bit edges and samples can also be off by up to a timer tick: that
+// is added, spread over the 9.5 bits to the middle of the stop bit. Frames
+// start to fail past about 2%.
+float SoftwareSerial::bitError() {
+  if (!_speed) return 0;
+  uint32_t rate = timerRate();
+  float err = ((int64_t)(HAL_softserial_tick_time(rate) * rate) - 1000000000000LL) / 1e10f;
+  uint32_t unit = _receivePin >= 0 && _receive_buffer ? tickRate() : _speed;
+  if (rate % unit) {
+    float grid = 100.0f * _speed / rate / 9.5f;
+    err += err < 0 ? -grid : grid;
+  }
+  return err;
+}
+
+// Detect start bits with a pin interrupt instead of polling the line, so the
+// timer only runs while a frame is received or sent. Returns false if the
+// HAL cannot mask the pin interrupt.
+bool SoftwareSerial::setEdgeWake(bool enable) {
+  if (enable && !HAL_SS_EDGE_WAKE) return false;
+  setRXMode(enable, false, false);
+  return true;
+}
+
+// Decode received frames from pin edge time stamps, without the timer.
+// Returns false if the HAL has no edge time stamps or cannot mask the pin
+// interrupt.
+bool SoftwareSerial::setCaptureRX(bool enable) {
+  if (enable && !(HAL_SS_EDGE_CAPTURE && HAL_SS_EDGE_WAKE)) return false;
+  setRXMode(false, enable, false);
+  return true;
+}
+
+// Sample the RX port with timer triggered DMA and decode the samples in
+// batches, without any per sample interrupt. Returns false if the HAL has
+// no DMA sampling.
+bool SoftwareSerial::setDmaRX(bool enable) {
+  if (enable && !HAL_SS_DMA_RX) return false;
+  setRXMode(false, false, enable);
+  return true;
+}
+
+// Send with a timer triggered DMA waveform instead of the interrupt
+// handler. Returns false if the HAL has no DMA output.
+bool SoftwareSerial::setDmaTX(bool enable) {
+  if (enable && !HAL_SS_DMA_TX) return false;
+  while (transmitting()) HAL_softserial_busy_wait();
+  _dma_tx = enable;
+  return true;
+}
+
+// Timer ticks per bit, OVERSAMPLE by default. The timer only runs as fast
+// as the active instances need: receiving takes at least 3 to find the
+// middle of the bits. Transmitting alone ticks once per bit, so 1 suits
+// TX-only instances. Along with receivers the transmitter ticks at least
+// OVERSAMPLE times per bit whatever its factor, and its bit edges can be
+// off by up to a tick of the receivers' timer. Returns false if the factor
+// does not suit the instance, or is below 5 while voting.
+bool SoftwareSerial::setOversample(uint8_t factor) {
+  if (!factor || (factor < 3 && _receivePin >= 0 && _receive_buffer)) return false;
+  if (_vote_ticks && !voteTicks(factor)) return false;
+  bool relisten = stopListening();
+  while (transmitting()) HAL_softserial_busy_wait();
+  _oversample = factor;
+  if (_vote_ticks)
+    _vote_ticks = voteTicks(factor);
+  if (relisten)
     listen();
+  return true;
+}
+
+// Take each bit by majority from three samples, at the middle of the bit and
+// a fifth of a bit either side in whole ticks, so spikes shorter than that
+// are voted down. Disagreeing samples set the noise() flag. The stop bit is
+// checked at its middle and once before, so that frames sent back to back by
+// a fast sender are not lost. Needs 5 or more ticks per bit: returns false
+// and keeps one sample per bit at a lower factor. Not used by
+// SoftwareSerialGroup or capture decoding.
+bool SoftwareSerial::setMajorityVote(bool enable) {
+  if (enable && !voteTicks(_oversample)) return false;
+  bool relisten = stopListening();
+  _vote_ticks = enable ? voteTicks(_oversample) : 0;
+  if (relisten)
+    listen();
+  return true;
+}
+
+void SoftwareSerial::setRXMode(bool edge_wake, bool capture, bool dma) {
+  bool relisten = stopListening();
+  // the pin interrupt is attached by listen() for the mode in use
+  if (_edge_attached) {
+    HAL_softserial_edge_detach(_receivePin);
+    _edge_attached = false;
   }
+  _edge_wake = edge_wake;
+  _capture_rx = capture;
+  _dma_rx = dma;
+  if (relisten)
+    listen();
 }
 
 void SoftwareSerial::end() {
+  // let queued output drain
+  while (transmitting()) HAL_softserial_busy_wait();
   stopListening();
 }
 
 // Read data from buffer
 int SoftwareSerial::read() {
+  if (_capture_rx || _dma_rx) flushRX();
   // Empty buffer?
   if (_receive_buffer_head == _receive_buffer_tail) return -1;
 
   // Read from "head"
   uint8_t d = _receive_buffer[_receive_buffer_head]; // grab next byte
-  _receive_buffer_head = (_receive_buffer_head + 1) % _SS_MAX_RX_BUFF;
+  _receive_buffer_head = (_receive_buffer_head + 1) & _receive_buffer_mask;
   return d;
 }
 
+// Read up to size bytes without waiting, in at most two copies
+size_t SoftwareSerial::read(uint8_t *buffer, size_t size) {
+  if (_capture_rx || _dma_rx) flushRX();
+  uint16_t head = _receive_buffer_head;
+  size_t count = (_receive_buffer_tail - head) & _receive_buffer_mask;
+  if (size < count) count = size;
+  if (!count) return 0;
+
+  size_t run = _receive_buffer_mask + 1 - head;
+  if (run > count) run = count;
+  memcpy(buffer, &_receive_buffer[head], run);
+  memcpy(buffer + run, _receive_buffer, count - run);
+  _receive_buffer_head = (head + count) & _receive_buffer_mask;
+  return count;
+}
+
+// Point data at the largest contiguous run of received bytes and return its
+// length. The bytes stay in the buffer until consume() releases them.
+size_t SoftwareSerial::peekSpan(const uint8_t *&data) {
+  if (_capture_rx || _dma_rx) flushRX();
+  uint16_t head = _receive_buffer_head, tail = _receive_buffer_tail;
+  data = _receive_buffer + head;
+  return tail >= head ? tail - head : _receive_buffer_mask + 1 - head;
+}
+
+// Drop count bytes (at most all available) from the front of the buffer
+void SoftwareSerial::consume(size_t count) {
+  uint16_t head = _receive_buffer_head;
+  size_t avail = (_receive_buffer_tail - head) & _receive_buffer_mask;
+  if (count > avail) count = avail;
+  _receive_buffer_head = (head + count) & _receive_buffer_mask;
+}
+
+// Stream::readBytes() semantics, the timeout restarts with each byte received
+size_t SoftwareSerial::readBytes(char *buffer, size_t length) {
+  size_t count = read((uint8_t *)buffer, length);
+  unsigned long start = millis();
+  while (count < length) {
+    size_t n = read((uint8_t *)buffer + count, length - count);
+    if (n) {
+      count += n;
+      start = millis();
+    }
+    else if (millis() - start >= _timeout)
+      break;
+    else
+      HAL_softserial_busy_wait();
+  }
+  return count;
+}
+
 int SoftwareSerial::available() {
-  return (_receive_buffer_tail + _SS_MAX_RX_BUFF - _receive_buffer_head) % _SS_MAX_RX_BUFF;
+  if (_capture_rx || _dma_rx) flushRX();
+  return (_receive_buffer_tail - _receive_buffer_head) & _receive_buffer_mask;
 }
 
 size_t SoftwareSerial::write(uint8_t b) {
-  // wait for previous transmit to complete
-  _output_pending = 1;
-  while(active_out) ;
-  // add start and stop bits.
-  tx_buffer = b << 1 | 0x200;
-  tx_bit_cnt = 0;
-  tx_tick_cnt = OVERSAMPLE;
-  setSpeed(_speed);
-  if (_half_duplex)
-    setRXTX(false);
-  _output_pending = 0;
-  // make us active
-  active_out = this;
+  if (_transmitPin < 0) return 0;
+  // wait for room in the buffer
+  uint16_t next = (_transmit_buffer_tail + 1) & (_SS_MAX_TX_BUFF - 1);
+  while (next == _transmit_buffer_head) HAL_softserial_busy_wait();
+
+  _transmit_buffer[_transmit_buffer_tail] = b;
+  _transmit_buffer_tail = next;
+
+  startTransmit();
   return 1;
 }
 
+size_t SoftwareSerial::write(const uint8_t *buffer, size_t size) {
+  if (_transmitPin < 0) return 0;
+  size_t left = size;
+  while (left) {
+    uint16_t tail = _transmit_buffer_tail;
+    size_t room = (_transmit_buffer_head - 1 - tail) & (_SS_MAX_TX_BUFF - 1);
+    if (!room) {
+      // full, so already transmitting: wait for the handler to make room
+      HAL_softserial_busy_wait();
+      continue;
+    }
+
+    // copy the largest contiguous run and publish it at once
+    size_t run = _SS_MAX_TX_BUFF - tail;
+    if (run > room) run = room;
+    if (run > left) run = left;
+    memcpy(&_transmit_buffer[tail], buffer, run);
+    _transmit_buffer_tail = (tail + run) & (_SS_MAX_TX_BUFF - 1);
+    buffer += run;
+    left -= run;
+
+    startTransmit();
+  }
+  return size;
+}
+
+int SoftwareSerial::availableForWrite() {
+  return (_transmit_buffer_head - 1 - _transmit_buffer_tail) & (_SS_MAX_TX_BUFF - 1);
+}
+
 void SoftwareSerial::flush() {
-  cli();
+  ss_cli();
   _receive_buffer_head = _receive_buffer_tail = 0;
-  sei();
+  ss_sei();
 }
 
 int SoftwareSerial::peek() {
+  if (_capture_rx || _dma_rx) flushRX();
   // Empty buffer?
   if (_receive_buffer_head == _receive_buffer_tail)
     return -1;
@@ -320,3 +938,185 @@ int SoftwareSerial::peek() {
   // Read from "head"
   return _receive_buffer[_receive_buffer_head];
 }
+
+//
+// Group of channels on one port
+//
+SoftwareSerialGroup::SoftwareSerialGroup() :
+  SoftwareSerial(-1, -1, false, (uint16_t)0),
+  _tx_channels(0),
+  _rx_channels(0) {
+  _half_duplex = false;
+  _virtual_tick = true;
+}
+
+SoftwareSerialGroup::~SoftwareSerialGroup() {
+  stopListening();
+  while (_tx_channels) remove(*_tx_channel[0]);
+  while (_rx_channels) remove(*_rx_channel[0]);
+}
+
+bool SoftwareSerialGroup::add(SoftwareSerial &channel) {
+  bool tx = channel._transmitPin >= 0,
+       rx = channel._receivePin >= 0 && channel._receive_buffer && !channel._half_duplex;
+  for (uint8_t i = 0; i < _rx_channels; i++)
+    if (_rx_channel[i] == &channel) return false;
+  if (channel._tx_group || !channel._speed || (!tx && !rx)) return false;
+  if ((_tx_channels || _rx_channels) && (channel._speed != _speed || channel._oversample != _oversample)) return false;
+  if (tx && (_tx_channels >= _SS_MAX_GROUP || (_tx_channels && channel._transmitPort != _transmitPort))) return false;
+  if (rx && (_rx_channels >= _SS_MAX_GROUP || (_rx_channels && channel._receivePort != _receivePort))) return false;
+
+  // let the channel's own output and ours drain first
+  while (channel.transmitting() || active_out == this) HAL_softserial_busy_wait();
+  _speed = channel._speed;
+  _oversample = channel._oversample;
+  if (tx) {
+    _transmitPort = channel._transmitPort;
+    _tx_frame[_tx_channels] = 0;
+    _tx_channel[_tx_channels++] = &channel;
+    channel._tx_group = this;
+  }
+  if (rx) {
+    // the group receives for the channel, it cannot listen on its own
+    channel.stopListening();
+    channel._rx_grouped = true;
+    ss_cli();
+    _receivePort = channel._receivePort;
+    _rx_bit[_rx_channels] = -1;
+    _rx_tick[_rx_channels] = 1;
+    _rx_channel[_rx_channels++] = &channel;
+    ss_sei();
+  }
+  return true;
+}
+
+void SoftwareSerialGroup::remove(SoftwareSerial &channel) {
+  while (active_out == this) HAL_softserial_busy_wait();
+  for (uint8_t i = 0; i < _tx_channels; i++)
+    if (_tx_channel[i] == &channel) {
+      channel._tx_group = NULL;
+      for (_tx_channels--; i < _tx_channels; i++) {
+        _tx_channel[i] = _tx_channel[i + 1];
+        _tx_frame[i] = _tx_frame[i + 1];
+      }
+      break;
+    }
+  ss_cli();
+  for (uint8_t i = 0; i < _rx_channels; i++)
+    if (_rx_channel[i] == &channel) {
+      channel._rx_grouped = false;
+      for (_rx_channels--; i < _rx_channels; i++) {
+        _rx_channel[i] = _rx_channel[i + 1];
+        _rx_tick[i] = _rx_tick[i + 1];
+        _rx_bit[i] = _rx_bit[i + 1];
+        _rx_byte[i] = _rx_byte[i + 1];
+      }
+      break;
+    }
+  ss_sei();
+}
+
+bool SoftwareSerialGroup::listen() {
+  if (!_rx_channels) return false;
+
+  if (_listening) stopListening();
+  for (uint8_t i = 0; i < _rx_channels; i++) {
+    _rx_bit[i] = -1;
+    _rx_tick[i] = 1;
+  }
+  if (!addListener())
+    return false;
+  ss_cli();
+  _rx_armed = true;
+  _rx_phase = 0;
+  _rx_active = true;
+  updateRate();
+  ss_sei();
+  return true;
+}
+
+// One tick for all RX channels, from a single read of their port
+void SoftwareSerialGroup::recv() {
+  uint32_t port = gpio_port_read(_receivePort);
+  for (uint8_t i = 0; i < _rx_channels; i++) {
+    if (--_rx_tick[i] > 0) continue;
+
+    SoftwareSerial *c = _rx_channel[i];
+    uint8_t inbit = ((port & c->_receiveMask) ? HIGH : LOW) ^ c->_inverse_logic;
+    if (_rx_bit[i] == -1) {
+      // waiting for start bit, checked again at its middle
+      if (inbit)
+        _rx_tick[i] = 1;
+      else {
+        _rx_bit[i] = -2;
+        _rx_tick[i] = _oversample / 2;
+      }
+    }
+    else if (_rx_bit[i] == -2) {
+      if (inbit) {
+        c->_false_starts++;
+        _rx_bit[i] = -1;
+        _rx_tick[i] = 1;
+      }
+      else {
+        _rx_bit[i] = 0;
+        _rx_tick[i] = _oversample;
+        _rx_byte[i] = 0;
+      }
+    }
+    else if (_rx_bit[i] < 8) {
+      // data bits
+      _rx_byte[i] = _rx_byte[i] >> 1 | inbit << 7;
+      _rx_bit[i]++;
+      _rx_tick[i] = _oversample;
+    }
+    else {
+      // stop bit
+      if (inbit) c->receiveByte(_rx_byte[i]);
+      _rx_bit[i] = -1;
+      _rx_tick[i] = 1;
+    }
+  }
+}
+
+// One tick for all channels: a channel between frames starts its next queued
+// byte, so frames of different channels need not line up
+void SoftwareSerialGroup::send() {
+  uint32_t set = 0, clear = 0;
+  bool busy = false;
+  for (uint8_t i = 0; i < _tx_channels; i++) {
+    SoftwareSerial *c = _tx_channel[i];
+    uint16_t frame = _tx_frame[i];
+    if (!frame) {
+      uint16_t head = c->_transmit_buffer_head;
+      if (head == c->_transmit_buffer_tail) continue;
+      // start bit, data, stop bit and an end marker
+      frame = c->_transmit_buffer[head] << 1 | 0x600;
+      c->_transmit_buffer_head = (head + 1) & (_SS_MAX_TX_BUFF - 1);
+      if (c->_half_duplex) c->setRXTX(false);
+    }
+    if ((frame & 1) ^ c->_inverse_logic)
+      set |= c->_transmitMask;
+    else
+      clear |= c->_transmitMask;
+    frame >>= 1;
+    _tx_frame[i] = frame == 1 ? 0 : frame;
+    busy = true;
+  }
+
+  if (busy) {
+    gpio_port_write(_transmitPort, set, clear);
+    tx_bit_cnt = 10;
+  }
+  else {
+    if (tx_bit_cnt++ >= 10 + 5) {
+      for (uint8_t i = 0; i < _tx_channels; i++) {
+        SoftwareSerial *c = _tx_channel[i];
+        if (c->_half_duplex && c->_listening)
+          c->setRXTX(true);
+      }
+      active_out = NULL;
+      updateRate();
+    }
+  }
+}
@@ -37,73 +37,440 @@
 #include <Arduino.h>
 #include <stdint.h>
 #include <Stream.h>
+#include "HAL_softserial.h"
 
 /******************************************************************************
 * Definitions
 ******************************************************************************/
 
-#define _SS_MAX_RX_BUFF 64 // RX buffer size
+// Ring sizes must be powers of two, indices are masked rather than wrapped
+#ifndef _SS_MAX_RX_BUFF
+  #define _SS_MAX_RX_BUFF 64 // default RX buffer size, can be set per instance
+#endif
+
+#ifndef _SS_MAX_TX_BUFF
+  #define _SS_MAX_TX_BUFF 32 // TX buffer size, drained by the interrupt handler
+#endif
+
+#ifndef _SS_DMA_RX_SAMPLES
+  #define _SS_DMA_RX_SAMPLES 64 // DMA sampled port words, decoded half a buffer at a time
+#endif
+
+#ifndef _SS_DMA_TX_FRAMES
+  #define _SS_DMA_TX_FRAMES 4   // frames in the DMA TX waveform, refilled half at a time
+#endif
+
+static_assert(!(_SS_MAX_RX_BUFF & (_SS_MAX_RX_BUFF - 1)), "_SS_MAX_RX_BUFF must be a power of 2");
+static_assert(_SS_MAX_TX_BUFF >= 2 && !(_SS_MAX_TX_BUFF & (_SS_MAX_TX_BUFF - 1)), "_SS_MAX_TX_BUFF must be a power of 2");
+static_assert(_SS_DMA_RX_SAMPLES >= 2 && !(_SS_DMA_RX_SAMPLES & (_SS_DMA_RX_SAMPLES - 1)), "_SS_DMA_RX_SAMPLES must be a power of 2");
+static_assert(_SS_DMA_TX_FRAMES >= 2 && !(_SS_DMA_TX_FRAMES & 1), "_SS_DMA_TX_FRAMES must be even");
+
+// Set to 1 when gpio_port()/gpio_mask() of a constant pin fold to constants
+// (pin map is a formula, or LTO sees the core's pin table). Templated
+// instances then access their port without loading it from the object.
+// Only the Linux HAL sets it: the STM32, STM32F1 and SAMD51 cores look pins
+// up in run time tables, so there templated instances still load the port
+// and mask cached in the object, and only fold the inverse and half duplex
+// branches.
+#ifndef HAL_SS_CONST_PINMAP
+  #define HAL_SS_CONST_PINMAP 0
+#endif
+
+#ifndef _SS_MAX_LISTENERS
+  #define _SS_MAX_LISTENERS 4   // instances receiving at the same time
+#endif
+
+#ifndef _SS_MAX_GROUP
+  #define _SS_MAX_GROUP 8       // channels of a SoftwareSerialGroup
+#endif
+
+class SoftwareSerialGroup;
 
 class SoftwareSerial : public Stream {
+  friend class SoftwareSerialGroup;
+
   private:
     // per object data
     int16_t _receivePin;
     int16_t _transmitPin;
+    ss_port_t _receivePort;
+    ss_port_t _transmitPort;
+    uint32_t _receiveMask;
+    uint32_t _transmitMask;
     uint32_t _speed;
+    uint8_t _oversample;               // timer ticks per bit
+    uint8_t _vote_ticks;               // ticks between the samples a bit is voted from, 0 for one sample
 
-    uint16_t _buffer_overflow:1;
     uint16_t _inverse_logic:1;
     uint16_t _half_duplex:1;
-    uint16_t _output_pending:1;
+    uint16_t _receive_buffer_alloc:1;
+    uint16_t _edge_wake:1;
+    uint16_t _capture_rx:1;
+    uint16_t _dma_rx:1;
+    uint16_t _dma_tx:1;
+    uint16_t _edge_attached:1;
+    uint16_t _listening:1;
+    uint16_t _rx_grouped:1;            // received by a SoftwareSerialGroup
+
+    // set by the interrupt handlers, apart from the flags above so that their
+    // read-modify-write in main context cannot lose them
+    volatile bool _buffer_overflow;
+    volatile bool _rx_noise;           // samples of a bit disagreed
+    volatile bool _rx_armed;           // receive direction, waiting for or decoding frames
+    volatile bool _rx_active;          // decoded by the timer interrupt
+    uint32_t _rx_phase;                // divides the timer down to our tick rate
+
+    // frame being received
+    int16_t _rx_tick_cnt;
+    int8_t _rx_bit_cnt;                // -1 waiting for a start bit, -2 checking one
+    uint8_t _rx_buffer;
+    uint8_t _rx_level;
+    uint8_t _rx_votes;                 // samples of the bit so far, after a leading 1
+    volatile uint16_t _false_starts;   // start bits that did not last, wrapping count
+    uint32_t _rx_frame_start;
+    uint32_t _capture_bit;             // bit time in HAL_softserial_edge_clock() counts
 
-    unsigned char _receive_buffer[_SS_MAX_RX_BUFF];
-    volatile uint8_t _receive_buffer_tail;
-    volatile uint8_t _receive_buffer_head;
+    unsigned char *_receive_buffer;    // NULL when the instance does not receive
+    uint16_t _receive_buffer_mask;     // ring size - 1
+    volatile uint16_t _receive_buffer_tail;
+    volatile uint16_t _receive_buffer_head;
+
+    unsigned char _transmit_buffer[_SS_MAX_TX_BUFF];
+    volatile uint16_t _transmit_buffer_tail;
+    volatile uint16_t _transmit_buffer_head;
+    SoftwareSerial *_tx_group;         // transmitter of the group sending for us, or NULL
 
     uint32_t delta_start;
 
     // static data
     static bool initialised;
-    static SoftwareSerial * active_listener;
+    static SoftwareSerial *listeners[_SS_MAX_LISTENERS];
+    static volatile uint8_t listener_cnt;
     static SoftwareSerial * volatile active_out;
-    static SoftwareSerial * volatile active_in;
-    static int32_t tx_tick_cnt;
-    static int32_t rx_tick_cnt;
+    static SoftwareSerial * volatile dma_out;
     static uint32_t tx_buffer;
     static int32_t tx_bit_cnt;
-    static uint32_t rx_buffer;
-    static int32_t rx_bit_cnt;
-    static uint32_t cur_speed;
+    static uint32_t rx_sample;
+    static uint16_t rx_sample_pos;
+    static uint8_t tx_wave_data;
+    static uint32_t cur_rate;          // timer ticks per second
+    static uint32_t tx_phase;
+    static uint32_t tick_due;          // HAL_softserial_edge_time() the last tick was due
+    static uint32_t tick_clocks;       // timer period in HAL_softserial_edge_clock() counts, truncated
+    static uint32_t tick_rest;         // the rest of it, in 1/cur_rate counts
+    static uint32_t tick_frac;         // rest added up since tick_due was set, in 1/cur_rate counts
 
     // private methods
-    void send();
-    void recv();
     void setTX();
     void setRX();
-    void setSpeed(uint32_t speed);
+    uint32_t tickRate() const { return _speed * _oversample; }
+    // vote spacing for a factor: a fifth of a bit in whole ticks, 0 below 5 ticks per bit
+    static uint8_t voteTicks(uint8_t factor) { return factor / 5; }
+    // rate a transmitter asks for, on its own or along with receivers
+    uint32_t txRate(bool receivers) const { return receivers ? _speed * (_oversample > OVERSAMPLE ? _oversample : OVERSAMPLE) : _speed; }
+    uint32_t timerRate();
+    static void updateRate();
+    static void catchUp(uint32_t ticks);
     void setRXTX(bool input);
+    void startTransmit();
+    bool addListener();
+    bool transmitting() { return active_out == this || dma_out == this || (_tx_group && active_out == _tx_group); }
+    void armStartBit();
+    void disarmStartBit();
+    void setRXMode(bool edge_wake, bool capture, bool dma);
+    inline void checkStartBit();
+    inline void receiveByte(uint8_t b);
+    void captureBits(uint32_t upto, uint8_t level);
+    void dmaDecode();
+    bool dmaFill(uint8_t half);
+    void flushRX();
+
+  protected:
+    // pin access for the interrupt time engine
+    struct RuntimeIO;
+    template<int16_t RX, int16_t TX, bool INV> struct ConstIO;
+    struct SampleIO;
+
+    // interrupt time engine, one tick per call
+    template<class IO> inline void send_tick();
+    template<class IO> inline void recv_tick();
+    virtual void send();
+    virtual void recv();
+    // set by subclasses overriding send()/recv(): only they cost the
+    // interrupt handler a virtual call, run time pins are ticked inline
+    bool _virtual_tick;
+    inline void sendTick();
+    inline void recvTick();
 
   public:
     // public methods
 
-    SoftwareSerial(int16_t receivePin, int16_t transmitPin, bool inverse_logic = false);
+    // rx_buffer_size is rounded up to a power of 2, from 2 to 32768, and allocated, 0 for no receive buffer.
+    // The ring holds one byte less than its size.
+    SoftwareSerial(int16_t receivePin, int16_t transmitPin, bool inverse_logic = false, uint16_t rx_buffer_size = _SS_MAX_RX_BUFF);
+    // caller provided receive buffer, of which the largest power of 2 that fits rx_buffer_size is used,
+    // none below 2 bytes
+    SoftwareSerial(int16_t receivePin, int16_t transmitPin, bool inverse_logic, unsigned char *rx_buffer, uint16_t rx_buffer_size);
     ~SoftwareSerial();
-    void begin(long speed);
+    // the allocated receive buffer and the listener registry entry belong to one object
+    SoftwareSerial(const SoftwareSerial &) = delete;
+    SoftwareSerial &operator=(const SoftwareSerial &) = delete;
+    bool begin(long speed);
     bool listen();
     void end();
-    bool isListening() { return active_listener == this; }
+    bool isListening() { return _listening; }
     bool stopListening();
     bool overflow() { bool ret = _buffer_overflow; if (ret) _buffer_overflow = false; return ret; }
+    bool noise() { bool ret = _rx_noise; if (ret) _rx_noise = false; return ret; }
+    uint16_t falseStarts() { return _false_starts; }
     int peek();
+    bool setEdgeWake(bool enable);
+    bool setCaptureRX(bool enable);
+    bool setDmaRX(bool enable);
+    bool setDmaTX(bool enable);
+    bool setOversample(uint8_t factor);
+    bool setMajorityVote(bool enable);
+    size_t peekSpan(const uint8_t *&data);
+    void consume(size_t count);
+    uint32_t bitPeriod();
+    float bitError();
 
     virtual size_t write(uint8_t byte);
+    virtual size_t write(const uint8_t *buffer, size_t size);
+    using Print::write;
+    virtual int availableForWrite();
     virtual int read();
+    size_t read(uint8_t *buffer, size_t size);
+    size_t readBytes(char *buffer, size_t length);
+    size_t readBytes(uint8_t *buffer, size_t length) { return readBytes((char *)buffer, length); }
     virtual int available();
     virtual void flush();
     operator bool() { return true; }
 
     // public only for easy access by interrupt handlers
     [[gnu::always_inline]] static inline void handle_interrupt();
+    static void handle_start_bit();
+    static void handle_capture_edge();
+    static void handle_dma_rx();
+    static void handle_dma_tx(uint8_t half);
+};
+
+// Store a received byte, or flag the overflow
+inline void SoftwareSerial::receiveByte(uint8_t b) {
+  uint16_t next = (_receive_buffer_tail + 1) & _receive_buffer_mask;
+  if (next != _receive_buffer_head) {
+    // save new data in buffer: tail points to where byte goes
+    _receive_buffer[_receive_buffer_tail] = b; // save new byte
+    _receive_buffer_tail = next;
+  }
+  else
+    _buffer_overflow = true;
+}
+
+//
+// Pin access policies: run time pins and flags of the instance, or pins and
+// logic fixed at compile time so the engine folds the flag branches away
+//
+struct SoftwareSerial::RuntimeIO {
+  static inline bool inverse(const SoftwareSerial *s) { return s->_inverse_logic; }
+  static inline bool half_duplex(const SoftwareSerial *s) { return s->_half_duplex; }
+  static inline void tx(SoftwareSerial *s, uint8_t v) { gpio_port_set(s->_transmitPort, s->_transmitMask, v); }
+  static inline uint8_t rx(const SoftwareSerial *s) { return gpio_port_get(s->_receivePort, s->_receiveMask); }
+};
+
+template<int16_t RX, int16_t TX, bool INV>
+struct SoftwareSerial::ConstIO {
+  static inline bool inverse(const SoftwareSerial *) { return INV; }
+  static inline bool half_duplex(const SoftwareSerial *) { return RX == TX; }
+  static inline void tx(SoftwareSerial *s, uint8_t v) {
+    if (HAL_SS_CONST_PINMAP) gpio_port_set(gpio_port(TX), gpio_mask(TX), v);
+    else gpio_port_set(s->_transmitPort, s->_transmitMask, v);
+  }
+  static inline uint8_t rx(const SoftwareSerial *s) {
+    if (HAL_SS_CONST_PINMAP) return gpio_port_get(gpio_port(RX), gpio_mask(RX));
+    return gpio_port_get(s->_receivePort, s->_receiveMask);
+  }
+};
+
+// Receive from the port word sampled by DMA
+struct SoftwareSerial::SampleIO : RuntimeIO {
+  static inline uint8_t rx(const SoftwareSerial *s) { return (rx_sample & s->_receiveMask) ? HIGH : LOW; }
+};
+
+//
+// The transmit routine called by the interrupt handler, once per bit
+//
+template<class IO>
+inline void SoftwareSerial::send_tick() {
+  if (tx_bit_cnt < 10) {
+    // send data (including start and stop bits)
+    IO::tx(this, (tx_buffer & 1) ^ IO::inverse(this));
+    tx_buffer >>= 1;
+    tx_bit_cnt++;
+  }
+  else if (_transmit_buffer_head != _transmit_buffer_tail) {
+    // next byte queued: its start bit follows the stop bit without a gap
+    uint16_t head = _transmit_buffer_head;
+    tx_buffer = _transmit_buffer[head] << 1 | 0x200;
+    _transmit_buffer_head = (head + 1) & (_SS_MAX_TX_BUFF - 1);
+    IO::tx(this, IO::inverse(this));
+    tx_buffer >>= 1;
+    tx_bit_cnt = 1;
+  }
+  else {
+    // keep the line for 5 idle bits before letting go
+    if (tx_bit_cnt++ >= 10 + 5) {
+      if (IO::half_duplex(this) && _listening)
+        setRXTX(true);
+      active_out = NULL;
+      // slow the timer down to what the listeners need, or stop it
+      updateRate();
+    }
+  }
+}
+
+// The line went to space level, for a start bit or a spike: look again at the
+// middle of the start bit, by majority when voting.
+inline void SoftwareSerial::checkStartBit() {
+  _rx_bit_cnt = -2;
+  _rx_votes = 1;
+  _rx_tick_cnt = _oversample / 2 - _vote_ticks;
+}
+
+//
+// The receive routine called by the interrupt handler
+//
+template<class IO>
+inline void SoftwareSerial::recv_tick() {
+  if (--_rx_tick_cnt > 0) return;
+
+  uint8_t inbit = IO::rx(this) ^ IO::inverse(this);
+  if (_rx_bit_cnt != -1 && _vote_ticks) {
+    // samples before and after the middle of the bit vote along. The stop
+    // bit ends at its middle, where hunting for the next start bit begins
+    // as without voting, and only a sample before it is checked.
+    _rx_votes = _rx_votes << 1 | inbit;
+    if (_rx_votes < (_rx_bit_cnt == 8 ? 4 : 8)) {
+      _rx_tick_cnt = _vote_ticks;
+      return;
+    }
+    if (_rx_bit_cnt == 8) {
+      if ((_rx_votes ^ _rx_votes >> 1) & 1) _rx_noise = true;
+    }
+    else {
+      if (_rx_votes != 8 && _rx_votes != 15) _rx_noise = true;
+      inbit = 0xE8 >> (_rx_votes & 7) & 1;
+    }
+    _rx_votes = 1;
+  }
+  if (_rx_bit_cnt == -1) {
+    // waiting for start bit
+    if (inbit)
+      _rx_tick_cnt = 1;
+    else
+      checkStartBit();
+  }
+  else if (_rx_bit_cnt == -2 && !inbit) {
+    // got start bit
+    _rx_bit_cnt = 0;
+    _rx_tick_cnt = _oversample - 2 * _vote_ticks;
+    _rx_buffer = 0;
+  }
+  else if (_rx_bit_cnt >= 0 && _rx_bit_cnt < 8) {
+    // data bits
+    _rx_buffer >>= 1;
+    if (inbit)
+      _rx_buffer |= 0x80;
+    _rx_bit_cnt++;
+    _rx_tick_cnt = _oversample - 2 * _vote_ticks;
+  }
+  else {
+    if (_rx_bit_cnt == -2) {
+      // back at idle level by the middle of the start bit: a spike
+      _false_starts++;
+    }
+    else if (inbit) {
+      // stop bit read complete add to buffer
+      receiveByte(_rx_buffer);
+    }
+    _rx_bit_cnt = -1;
+    if (_edge_wake) {
+      // stop the timer until the next start bit edge, unless still transmitting
+      _rx_active = false;
+      updateRate();
+      gpio_edge_enable(_receivePin);
+    }
+    else
+      _rx_tick_cnt = 1;
+  }
+}
+
+inline void SoftwareSerial::sendTick() {
+  if (_virtual_tick) send();
+  else send_tick<RuntimeIO>();
+}
+
+inline void SoftwareSerial::recvTick() {
+  if (_virtual_tick) recv();
+  else recv_tick<RuntimeIO>();
+}
+
+//
+// Instance with pins and logic fixed at compile time. Its ticks cost the
+// interrupt handler a virtual call, so it pays off where HAL_SS_CONST_PINMAP
+// is 1; elsewhere it saves little over a plain instance.
+//
+template<int16_t RxPin, int16_t TxPin, bool Inverse = false, uint16_t RxBufferSize = _SS_MAX_RX_BUFF>
+class SoftwareSerialT : public SoftwareSerial {
+  static_assert(RxBufferSize != 1 && !(RxBufferSize & (RxBufferSize - 1)), "RxBufferSize must be 0 or a power of 2 from 2 on");
+
+  private:
+    unsigned char _rx_storage[RxBufferSize ? RxBufferSize : 1];
+
+  public:
+    SoftwareSerialT() : SoftwareSerial(RxPin, TxPin, Inverse, RxBufferSize ? _rx_storage : NULL, RxBufferSize) { _virtual_tick = true; }
+
+  protected:
+    virtual void send() { send_tick<ConstIO<RxPin, TxPin, Inverse> >(); }
+    virtual void recv() { recv_tick<ConstIO<RxPin, TxPin, Inverse> >(); }
+};
+
+//
+// Serial channels with pins on one port, sent and received concurrently:
+// each tick sets and clears the TX pins of all channels with a single port
+// write, and decodes all RX pins from a single port read. Channels keep
+// their own write(), read() and buffers, the group sends and receives for
+// them. Half-duplex channels are sent for but not received.
+//
+class SoftwareSerialGroup : private SoftwareSerial {
+  private:
+    SoftwareSerial *_tx_channel[_SS_MAX_GROUP];
+    uint16_t _tx_frame[_SS_MAX_GROUP]; // bits left to send, LSB first, 0 between frames
+    uint8_t _tx_channels;
+
+    SoftwareSerial *_rx_channel[_SS_MAX_GROUP];
+    int8_t _rx_tick[_SS_MAX_GROUP];
+    int8_t _rx_bit[_SS_MAX_GROUP];     // -1 while waiting for a start bit, -2 checking one
+    uint8_t _rx_byte[_SS_MAX_GROUP];
+    uint8_t _rx_channels;
+
+  protected:
+    virtual void send();
+    virtual void recv();
+
+  public:
+    SoftwareSerialGroup();
+    ~SoftwareSerialGroup();
+    // channel must have begun at the speed and oversampling of the first
+    // one, TX pins on one port and RX pins on one port
+    bool add(SoftwareSerial &channel);
+    void remove(SoftwareSerial &channel);
+    uint8_t channels() { return _tx_channels > _rx_channels ? _tx_channels : _rx_channels; }
+    bool isSending() { return active_out == this; }
+    // receive on all RX channels, instead of the listening instance
+    bool listen();
+    using SoftwareSerial::isListening;
+    using SoftwareSerial::stopListening;
 };
 
 // Arduino 0012 workaround
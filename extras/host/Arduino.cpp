@@ -0,0 +1,62 @@
+/**
+ * Host build of SoftwareSerialM: a small Arduino core for the Linux HAL
+ */
+#include <stdio.h>
+#include "Arduino.h"
+#include "HAL_softserial.h"
+
+size_t Print::write(const uint8_t *buffer, size_t size) {
+  size_t n = 0;
+  while (size--) n += write(*buffer++);
+  return n;
+}
+
+size_t Print::print(long n, int base) {
+  if (n < 0 && base == DEC) return print('-') + print((unsigned long)-n, base);
+  return print((unsigned long)n, base);
+}
+
+size_t Print::print(unsigned long n, int base) {
+  char buf[8 * sizeof(long) + 1], *p = buf + sizeof(buf);
+  if (base < 2) base = DEC;
+  *--p = 0;
+  do {
+    uint8_t d = n % base;
+    *--p = d < 10 ? '0' + d : 'A' + d - 10;
+    n /= base;
+  } while (n);
+  return write(p);
+}
+
+size_t Print::print(double n, int digits) {
+  char buf[64];
+  snprintf(buf, sizeof(buf), "%.*f", digits, n);
+  return write(buf);
+}
+
+size_t Stream::readBytes(char *buffer, size_t length) {
+  size_t count = 0;
+  unsigned long start = millis();
+  while (count < length && millis() - start < _timeout) {
+    int c = read();
+    if (c >= 0) buffer[count++] = c;
+    else HAL_softserial_busy_wait();
+  }
+  return count;
+}
+
+size_t HardwareSerial::write(uint8_t c) { return fputc(c, stdout) == EOF ? 0 : 1; }
+size_t HardwareSerial::write(const uint8_t *buffer, size_t size) { return fwrite(buffer, 1, size, stdout); }
+void HardwareSerial::flush() { fflush(stdout); }
+
+HardwareSerial Serial;
+
+void pinMode(int, int) { }
+unsigned long millis() { return HAL_softserial_time_ns() / 1000000; }
+unsigned long micros() { return HAL_softserial_time_ns() / 1000; }
+
+int main() {
+  setup();
+  Serial.flush();
+  return 0;
+}
@@ -0,0 +1,42 @@
+/**
+ * Host build of SoftwareSerialM: a small Arduino core for the Linux HAL
+ *
+ * Pins are the virtual ports of HAL_softserial_LINUX.h, so pinMode() only
+ * keeps the API, and millis() reads the simulated clock. Serial prints to
+ * stdout. main() runs setup() once and returns, loop() is never called.
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include "Stream.h"
+
+#define HIGH 1
+#define LOW  0
+
+#define INPUT          0
+#define OUTPUT         1
+#define INPUT_PULLUP   2
+#define INPUT_PULLDOWN 3
+
+void pinMode(int pin, int mode);
+unsigned long millis();
+unsigned long micros();
+
+void setup();
+void loop();
+
+class HardwareSerial : public Stream {
+  public:
+    void begin(unsigned long) {}
+    size_t write(uint8_t c);
+    size_t write(const uint8_t *buffer, size_t size);
+    using Print::write;
+    int available() { return 0; }
+    int read() { return -1; }
+    int peek() { return -1; }
+    void flush();
+};
+
+extern HardwareSerial Serial;
@@ -0,0 +1,22 @@
+/**
+ * Host build of SoftwareSerialM: the parts of the Arduino Stream class the
+ * library and the host sketches use.
+ */
+#pragma once
+
+#include "Print.h"
+
+class Stream : public Print {
+  protected:
+    unsigned long _timeout;
+
+  public:
+    Stream() : _timeout(1000) {}
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+
+    void setTimeout(unsigned long timeout) { _timeout = timeout; }
+    size_t readBytes(char *buffer, size_t length);
+    size_t readBytes(uint8_t *buffer, size_t length) { return readBytes((char *)buffer, length); }
+};
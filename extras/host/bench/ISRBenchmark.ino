@@ -0,0 +1,155 @@
+/**
+ * ISR cost benchmark for SoftwareSerial::handle_interrupt()
+ *
+ * Host only: built by extras/host/CMakeLists.txt and run by its bench
+ * target. The real interrupt path is stepped through the simulated timer
+ * of the Linux HAL and timed with the host clock. Numbers include the HAL stepping loop and
+ * the tick hook, so compare them between builds rather than with hardware.
+ *
+ * Pins: 0 = TX, 1 = RX, 2 = half-duplex line.
+ */
+
+#include <chrono>
+#include <SoftwareSerial.h>
+#include <HAL_softserial.h>
+
+#if HAL_SS_PLATFORM != HAL_PLATFORM_LINUX
+  #error "ISRBenchmark runs on the host only (HAL_PLATFORM_LINUX)."
+#endif
+
+#define BENCH_SPEED   115200
+#define BENCH_TICKS   300000
+#define BENCH_FRAME   (OVERSAMPLE * 10)   // ticks per frame on the wire
+#define BENCH_TX_FRAME  10                // transmitting alone, one tick per bit
+
+typedef std::chrono::steady_clock bench_clock;
+
+static uint64_t bench_bit_ns;
+static uint64_t bench_start_ns;
+
+// Feed a continuous stream of 0x55, 0xA3, ... frames into the RX pin
+static void rx_generator(uint64_t now_ns) {
+  uint64_t bit = (now_ns - bench_start_ns) / bench_bit_ns;
+  uint32_t frame = bit / 10, pos = bit % 10;
+  uint8_t data = 0x55 + frame * 0x4E;
+  gpio_set(1, pos == 0 ? LOW : pos == 9 ? HIGH : (data >> (pos - 1)) & 1);
+}
+
+// Wire the TX pin to the RX pin
+static void loopback(uint64_t) { gpio_set(1, gpio_get(0)); }
+
+static void no_traffic(uint64_t) { }
+
+struct bench_result {
+  uint64_t ticks;     // simulated timer periods
+  uint64_t irqs;      // timer interrupts actually run
+  double ns_per_tick;
+  uint64_t worst_ns;
+};
+
+// Time interrupts in batches for the average, and one by one for the worst
+// case. `feed` runs between batches, outside the timed region.
+static bench_result bench(void (*hook)(uint64_t), void (*feed)(), uint32_t batch) {
+  bench_result r = { 0, 0, 0, 0 };
+  uint64_t total_ns = 0;
+
+  HAL_softserial_tick_hook = hook;
+  bench_start_ns = HAL_softserial_time_ns();
+  while (r.ticks < BENCH_TICKS) {
+    if (feed) feed();
+    uint64_t irqs = HAL_softserial_ticks();
+    bench_clock::time_point t0 = bench_clock::now();
+    uint32_t n = HAL_softserial_step(batch);
+    total_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(bench_clock::now() - t0).count();
+    r.irqs += HAL_softserial_ticks() - irqs;
+    if (!n) break;
+    r.ticks += n;
+
+    if (feed) feed();
+    for (uint8_t i = 0; i < 32; i++) {
+      t0 = bench_clock::now();
+      HAL_softserial_step(1);
+      uint64_t dt = std::chrono::duration_cast<std::chrono::nanoseconds>(bench_clock::now() - t0).count();
+      if (dt > r.worst_ns) r.worst_ns = dt;
+    }
+  }
+  HAL_softserial_tick_hook = NULL;
+  r.ns_per_tick = r.ticks ? (double)total_ns / r.ticks : 0;
+  return r;
+}
+
+static void report(const char *name, const bench_result &r) {
+  Serial.print(name);
+  Serial.print("  ticks=");
+  Serial.print((unsigned long)r.ticks);
+  Serial.print("  irqs=");
+  Serial.print((unsigned long)r.irqs);
+  Serial.print("  ns/tick=");
+  Serial.print(r.ns_per_tick, 2);
+  Serial.print("  worst ns=");
+  Serial.println((unsigned long)r.worst_ns);
+}
+
+SoftwareSerial fullDuplex(1, 0);
+SoftwareSerial txOnly(-1, 0);
+SoftwareSerial halfDuplex(2, 2);
+
+static SoftwareSerial *feed_port;
+
+// Keep the transmitter busy and the receive buffer drained
+static void keep_busy() {
+  while (feed_port->read() >= 0) ;
+  feed_port->write(0x55);
+}
+
+static void drain() {
+  while (feed_port->read() >= 0) ;
+}
+
+// One request byte, then the turnaround back to receive and the idle gap
+static void turnaround() {
+  halfDuplex.write(0xA5);
+}
+
+void setup() {
+  Serial.begin(115200);
+  bench_bit_ns = 1000000000ULL / BENCH_SPEED;
+
+  fullDuplex.begin(BENCH_SPEED);
+  feed_port = &fullDuplex;
+  report("idle               ", bench(no_traffic, NULL, 1000));
+  report("rx only            ", bench(rx_generator, drain, 1000));
+  report("full duplex        ", bench(loopback, keep_busy, BENCH_FRAME));
+
+  fullDuplex.setEdgeWake(true);
+  report("idle, edge wake    ", bench(no_traffic, NULL, 1000));
+  report("rx only, edge wake ", bench(rx_generator, drain, 1000));
+  fullDuplex.setEdgeWake(false);
+
+  fullDuplex.setCaptureRX(true);
+  report("rx only, capture   ", bench(rx_generator, drain, 1000));
+  fullDuplex.setCaptureRX(false);
+
+  fullDuplex.setDmaRX(true);
+  report("rx only, dma       ", bench(rx_generator, drain, 1000));
+  fullDuplex.setDmaRX(false);
+  fullDuplex.end();
+
+  txOnly.begin(BENCH_SPEED);
+  feed_port = &txOnly;
+  report("tx only            ", bench(no_traffic, keep_busy, BENCH_TX_FRAME));
+  txOnly.end();
+
+  txOnly.setDmaTX(true);
+  txOnly.begin(BENCH_SPEED);
+  report("tx only, dma       ", bench(no_traffic, keep_busy, BENCH_FRAME));
+  txOnly.end();
+  txOnly.setDmaTX(false);
+
+  halfDuplex.begin(BENCH_SPEED);
+  halfDuplex.listen();
+  report("half duplex        ", bench(no_traffic, turnaround, BENCH_TX_FRAME + BENCH_FRAME));
+  halfDuplex.end();
+}
+
+void loop() { }
@@ -0,0 +1,114 @@
+/**
+ * False start check for SoftwareSerial::falseStarts()
+ *
+ * Host check, run by ctest in extras/host. A simulated line pulls the RX
+ * pin to space level for 2us, a quarter bit at 115200 baud, then sends a
+ * real frame 10 bits later, 50 times over. The spikes
+ * must not store any byte, the real frames must all arrive intact, and
+ * falseStarts() must count the spikes the receive mode saw:
+ *
+ *  - polling at 3 ticks per bit: only spikes that fall on a tick are seen,
+ *    so at least some and at most all of them
+ *  - at 8 ticks per bit, polling and edge wake with and without majority
+ *    voting, and capture decoding: each spike is seen, all of them are
+ *    counted. The simulated pin interrupt is
+ *    checked once per step, no longer than the shortest tick so far, so it
+ *    needs the finer grid to see every spike too.
+ *
+ * Every line reports the bytes right, the bytes received and the false
+ * starts counted, and PASS or FAIL.
+ *
+ * Pins: 1 = RX, 0 = TX (unused).
+ */
+
+#include <SoftwareSerial.h>
+#include <HAL_softserial.h>
+
+#if HAL_SS_PLATFORM != HAL_PLATFORM_LINUX
+  #error "FalseStarts runs on the host only (HAL_PLATFORM_LINUX)."
+#endif
+
+#define CHECK_SPEED   115200
+#define CHECK_CYCLES  50
+#define CYCLE_BITS    30      // spike at bit 0, frame from bit 10 on
+#define SPIKE_NS      2000
+
+static uint64_t gen_start_ns;
+static double bit_ns;
+
+static uint8_t frame_data(uint32_t cycle) { return 0x35 + cycle * 0x4D; }
+
+static void line(uint64_t now_ns) {
+  uint8_t level = HIGH;
+  if (now_ns >= gen_start_ns) {
+    uint64_t t = now_ns - gen_start_ns;
+    uint32_t bit = t / bit_ns, cycle = bit / CYCLE_BITS, pos = bit % CYCLE_BITS;
+    if (cycle < CHECK_CYCLES) {
+      if (t - (uint64_t)(cycle * CYCLE_BITS * bit_ns) < SPIKE_NS)
+        level = LOW;
+      else if (pos >= 10 && pos < 20)
+        level = pos == 10 ? LOW : pos == 19 ? HIGH : (frame_data(cycle) >> (pos - 11)) & 1;
+    }
+  }
+  gpio_set(1, level);
+}
+
+SoftwareSerial port(1, 0);
+
+static bool failed = false;
+
+static void check(const char *name, uint8_t factor, bool edge_wake, bool capture, bool vote, uint16_t min_false) {
+  port.end();
+  port.setMajorityVote(false);
+  port.setOversample(factor);
+  // setCaptureRX(false) turns edge wake off too, so that goes last
+  port.setCaptureRX(capture);
+  if (!capture) port.setEdgeWake(edge_wake);
+  port.setMajorityVote(vote);
+  port.begin(CHECK_SPEED);
+  while (port.read() >= 0) ;
+  uint16_t false_starts = port.falseStarts();
+
+  gen_start_ns = HAL_softserial_time_ns() + 3 * (uint64_t)bit_ns;
+  HAL_softserial_tick_hook = line;
+  uint16_t n = 0, right = 0;
+  uint64_t end = gen_start_ns + (uint64_t)(bit_ns * CYCLE_BITS * (CHECK_CYCLES + 1));
+  while (HAL_softserial_time_ns() < end) {
+    // steps of the simulated clock, also while only the pin interrupt is armed
+    HAL_softserial_step(1);
+    for (int c; (c = port.read()) >= 0; n++)
+      if (n < CHECK_CYCLES && c == frame_data(n)) right++;
+  }
+  HAL_softserial_tick_hook = NULL;
+  false_starts = port.falseStarts() - false_starts;
+
+  bool pass = right == CHECK_CYCLES && n == CHECK_CYCLES && false_starts >= min_false && false_starts <= CHECK_CYCLES;
+  Serial.print(name);
+  Serial.print("  right=");
+  Serial.print((unsigned long)right);
+  Serial.print("  received=");
+  Serial.print((unsigned long)n);
+  Serial.print("/");
+  Serial.print((unsigned long)CHECK_CYCLES);
+  Serial.print("  false starts=");
+  Serial.print((unsigned long)false_starts);
+  Serial.println(pass ? "  PASS" : "  FAIL");
+  if (!pass) failed = true;
+}
+
+void setup() {
+  Serial.begin(115200);
+  HAL_softSerial_init();
+  bit_ns = 1e9 / CHECK_SPEED;
+
+  check("x3 polling         ", 3, false, false, false, 1);
+  check("x8 polling         ", 8, false, false, false, CHECK_CYCLES);
+  check("x8 polling, voted  ", 8, false, false, true, CHECK_CYCLES);
+  check("x8 edge wake       ", 8, true, false, false, CHECK_CYCLES);
+  check("x8 edge wake, voted", 8, true, false, true, CHECK_CYCLES);
+  check("x8 capture         ", 8, false, true, false, CHECK_CYCLES);
+
+  Serial.println(failed ? "FAIL" : "PASS");
+}
+
+void loop() { }
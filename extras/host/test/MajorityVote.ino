@@ -0,0 +1,146 @@
+/**
+ * Majority vote check for SoftwareSerial::setMajorityVote()
+ *
+ * Host check, run by ctest in extras/host. A simulated sender drives the
+ * RX pin through the tick hook of the Linux HAL, and the bytes received are
+ * compared with the bytes sent. Every line reports the bytes right out of
+ * the bytes sent and whether noise() was set, and PASS or FAIL.
+ *
+ *  - setMajorityVote() refuses fewer than 5 ticks per bit
+ *  - back-to-back frames from a sender 1% fast and 1% slow, at 5, 8 and 16
+ *    ticks per bit, with and without voting, starting at four phases of a
+ *    tick: voting must receive them as intact as one sample per bit does,
+ *    and must not set noise()
+ *  - a spike of 0.1 bit at a random place in every data bit, at 8 ticks
+ *    per bit: one sample per bit must lose bytes to them, voting must vote
+ *    all of them down and set noise()
+ *
+ * Pins: 1 = RX, 0 = TX (unused).
+ */
+
+#include <stdlib.h>
+#include <SoftwareSerial.h>
+#include <HAL_softserial.h>
+
+#if HAL_SS_PLATFORM != HAL_PLATFORM_LINUX
+  #error "MajorityVote runs on the host only (HAL_PLATFORM_LINUX)."
+#endif
+
+#define CHECK_BYTES 200
+#define PHASES      4       // sender start phases per skew, in steps of a quarter tick
+
+static uint8_t sent[CHECK_BYTES], got[CHECK_BYTES];
+static uint64_t gen_start_ns;
+static double gen_bit_ns;
+static double gen_spike_bits;           // spike length in bits, 0 for none
+
+// Back-to-back frames of sent[], from gen_start_ns on. With spikes, each data
+// bit is inverted for gen_spike_bits at a place drawn from the frame and bit.
+static void sender(uint64_t now_ns) {
+  uint8_t level = HIGH;
+  if (now_ns >= gen_start_ns) {
+    double t = (now_ns - gen_start_ns) / gen_bit_ns;
+    uint32_t bit = (uint32_t)t, frame = bit / 10, pos = bit % 10;
+    if (frame < CHECK_BYTES) {
+      level = pos == 0 ? LOW : pos == 9 ? HIGH : (sent[frame] >> (pos - 1)) & 1;
+      if (gen_spike_bits && pos && pos < 9) {
+        double at = (bit * 2654435761UL % 1000) / 1000.0 * (1 - gen_spike_bits);
+        double in = t - bit;
+        if (in >= at && in < at + gen_spike_bits) level = !level;
+      }
+    }
+  }
+  gpio_set(1, level);
+}
+
+SoftwareSerial port(1, 0);
+static bool got_noise;
+
+// Send CHECK_BYTES frames, the first `phase` of a tick after a timer tick,
+// and return how many came in right
+static uint16_t run(uint32_t speed, uint8_t oversample, bool vote, double skew, double spike, double phase) {
+  port.end();
+  port.setMajorityVote(false);
+  port.setOversample(oversample);
+  port.setMajorityVote(vote);
+  port.begin(speed);
+  port.noise();
+  while (port.read() >= 0) ;
+
+  for (uint16_t i = 0; i < CHECK_BYTES; i++) sent[i] = rand();
+  gen_bit_ns = 1e9 / speed * (1 - skew);
+  gen_spike_bits = spike;
+  gen_start_ns = HAL_softserial_time_ns() + (uint64_t)(1e9 * (3 + phase / oversample) / speed);
+  HAL_softserial_tick_hook = sender;
+
+  uint16_t n = 0;
+  uint64_t end = gen_start_ns + (uint64_t)(gen_bit_ns * 10 * (CHECK_BYTES + 2));
+  while (HAL_softserial_time_ns() < end && HAL_softserial_step(1))
+    for (int c; n < CHECK_BYTES && (c = port.read()) >= 0; ) got[n++] = c;
+  HAL_softserial_tick_hook = NULL;
+  got_noise = port.noise();
+
+  uint16_t right = 0;
+  for (uint16_t i = 0; i < n; i++) if (got[i] == sent[i]) right++;
+  return right;
+}
+
+static bool failed = false;
+
+static void report(const char *name, uint32_t speed, uint8_t oversample, uint16_t right, uint16_t sent, bool pass) {
+  Serial.print(name);
+  Serial.print(" baud=");
+  Serial.print((unsigned long)speed);
+  Serial.print(" x");
+  Serial.print((unsigned long)oversample);
+  Serial.print("  right=");
+  Serial.print((unsigned long)right);
+  Serial.print("/");
+  Serial.print((unsigned long)sent);
+  Serial.print(got_noise ? "  noise" : "  clean");
+  Serial.println(pass ? "  PASS" : "  FAIL");
+  if (!pass) failed = true;
+}
+
+void setup() {
+  static const uint32_t speeds[] = { 9600, 115200, 250000 };
+  static const uint8_t factors[] = { 5, 8, 16 };
+  Serial.begin(115200);
+  HAL_softSerial_init();
+  srand(1);
+
+  port.setOversample(4);
+  bool refused = !port.setMajorityVote(true);
+  port.setOversample(5);
+  refused = refused && port.setMajorityVote(true) && !port.setOversample(4);
+  port.setMajorityVote(false);
+  Serial.println(refused ? "vote below x5 refused  PASS" : "vote below x5 refused  FAIL");
+  if (!refused) failed = true;
+
+  for (uint8_t s = 0; s < 3; s++)
+    for (uint8_t f = 0; f < 3; f++)
+      for (int8_t sign = -1; sign <= 1; sign += 2) {
+        double skew = sign * 0.01;
+        uint16_t plain = 0, voted = 0;
+        bool noisy = false;
+        for (uint8_t p = 0; p < PHASES; p++) {
+          plain += run(speeds[s], factors[f], false, skew, 0, (double)p / PHASES);
+          voted += run(speeds[s], factors[f], true, skew, 0, (double)p / PHASES);
+          noisy = noisy || got_noise;
+        }
+        got_noise = false;
+        report(sign > 0 ? "1% fast, plain " : "1% slow, plain ", speeds[s], factors[f], plain, PHASES * CHECK_BYTES, plain == PHASES * CHECK_BYTES);
+        got_noise = noisy;
+        report(sign > 0 ? "1% fast, voted " : "1% slow, voted ", speeds[s], factors[f], voted, PHASES * CHECK_BYTES, voted >= plain && !noisy);
+      }
+
+  // half a tick off the timer, so the samples straddle the middle of the bits
+  uint16_t plain = run(115200, 8, false, 0, 0.1, 0.5);
+  report("spikes, plain  ", 115200, 8, plain, CHECK_BYTES, plain < CHECK_BYTES);
+  uint16_t voted = run(115200, 8, true, 0, 0.1, 0.5);
+  report("spikes, voted  ", 115200, 8, voted, CHECK_BYTES, voted == CHECK_BYTES && got_noise);
+
+  Serial.println(failed ? "FAIL" : "PASS");
+}
+
+void loop() { }
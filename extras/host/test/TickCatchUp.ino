@@ -0,0 +1,159 @@
+/**
+ * Catch-up check for timer ticks held off by other interrupts
+ *
+ * Host check, run by ctest in extras/host. A simulated sender drives the
+ * RX pin through the tick hook of the Linux HAL, which also holds the timer
+ * interrupt off with HAL_softserial_hold(), as a higher priority interrupt
+ * such as a stepper ISR would. Ticks due meanwhile run once when the hold
+ * ends, like an interrupt flag, and the handler must catch up on the others.
+ * Every line reports the bytes right out of the bytes sent, and PASS or FAIL.
+ *
+ *  - 2.5us holds every 20 to 50us at 115200 baud and 8 ticks per bit: each
+ *    loses two ticks, and the samples read late stay within their bit. Every
+ *    byte must arrive intact, polling and with edge wake. With 3 ticks per
+ *    bit the samples already sit up to 2/3 into their bit, and a hold past
+ *    a tick pushes them out of it: polling needs the finer grid.
+ *  - the same holds while transmitting alone, at a tick per bit: no tick is
+ *    lost, the edges are only late. The bytes sent, decoded from the TX pin,
+ *    must be intact too
+ *
+ * Pins: 1 = RX, 0 = TX.
+ */
+
+#include <stdlib.h>
+#include <SoftwareSerial.h>
+#include <HAL_softserial.h>
+
+#if HAL_SS_PLATFORM != HAL_PLATFORM_LINUX
+  #error "TickCatchUp runs on the host only (HAL_PLATFORM_LINUX)."
+#endif
+
+#define CHECK_SPEED   115200
+#define CHECK_FACTOR  8
+#define CHECK_BYTES   200
+#define HOLD_NS       2500
+#define HOLD_MIN_NS   20000
+#define HOLD_MAX_NS   50000
+
+static uint8_t sent[CHECK_BYTES], got[CHECK_BYTES];
+static uint64_t gen_start_ns, next_hold_ns;
+static double bit_ns;
+
+static void hold_off(uint64_t now_ns) {
+  if (now_ns < next_hold_ns) return;
+  HAL_softserial_hold(HOLD_NS);
+  next_hold_ns = now_ns + HOLD_MIN_NS + rand() % (HOLD_MAX_NS - HOLD_MIN_NS);
+}
+
+// Back-to-back frames of sent[] from gen_start_ns on
+static void sender(uint64_t now_ns) {
+  uint8_t level = HIGH;
+  if (now_ns >= gen_start_ns) {
+    uint32_t bit = (now_ns - gen_start_ns) / bit_ns, frame = bit / 10, pos = bit % 10;
+    if (frame < CHECK_BYTES)
+      level = pos == 0 ? LOW : pos == 9 ? HIGH : (sent[frame] >> (pos - 1)) & 1;
+  }
+  gpio_set(1, level);
+  hold_off(now_ns);
+}
+
+// TX pin levels, sampled at every step for decoding afterwards
+#define TRACE_MAX 400000
+static uint64_t trace_ns[TRACE_MAX];
+static uint8_t trace_level[TRACE_MAX];
+static uint32_t trace_cnt;
+
+static void recorder(uint64_t now_ns) {
+  uint8_t level = gpio_get(0);
+  if (trace_cnt < TRACE_MAX && (!trace_cnt || trace_level[trace_cnt - 1] != level)) {
+    trace_ns[trace_cnt] = now_ns;
+    trace_level[trace_cnt++] = level;
+  }
+  hold_off(now_ns);
+}
+
+static uint8_t trace_at(double t) {
+  uint8_t level = HIGH;
+  for (uint32_t i = 0; i < trace_cnt && trace_ns[i] <= t; i++) level = trace_level[i];
+  return level;
+}
+
+SoftwareSerial port(1, 0);
+SoftwareSerial txOnly(-1, 0);
+
+static uint16_t receive(bool edge_wake) {
+  port.end();
+  port.setOversample(CHECK_FACTOR);
+  port.setEdgeWake(edge_wake);
+  port.begin(CHECK_SPEED);
+  while (port.read() >= 0) ;
+
+  for (uint16_t i = 0; i < CHECK_BYTES; i++) sent[i] = rand();
+  gen_start_ns = HAL_softserial_time_ns() + 3 * (uint64_t)bit_ns;
+  next_hold_ns = 0;
+  HAL_softserial_tick_hook = sender;
+
+  uint16_t n = 0;
+  uint64_t end = gen_start_ns + (uint64_t)(bit_ns * 10 * (CHECK_BYTES + 2));
+  while (HAL_softserial_time_ns() < end && HAL_softserial_step(1))
+    for (int c; n < CHECK_BYTES && (c = port.read()) >= 0; ) got[n++] = c;
+  HAL_softserial_tick_hook = NULL;
+  port.end();
+
+  uint16_t right = 0;
+  for (uint16_t i = 0; i < n; i++) if (got[i] == sent[i]) right++;
+  return right;
+}
+
+static uint16_t transmit() {
+  for (uint16_t i = 0; i < CHECK_BYTES; i++) sent[i] = rand();
+  trace_cnt = 0;
+  next_hold_ns = 0;
+  HAL_softserial_tick_hook = recorder;
+  txOnly.begin(CHECK_SPEED);
+  txOnly.write(sent, CHECK_BYTES);
+  txOnly.end();
+  HAL_softserial_tick_hook = NULL;
+
+  // decode from the first start bit on, frames back to back
+  uint16_t right = 0;
+  for (uint32_t i = 0; i < trace_cnt; i++)
+    if (trace_level[i] == LOW) {
+      double t0 = trace_ns[i];
+      for (uint16_t f = 0; f < CHECK_BYTES; f++) {
+        double start = t0 + f * 10 * bit_ns;
+        uint8_t b = 0;
+        for (uint8_t k = 0; k < 8; k++) b |= trace_at(start + bit_ns * (1.5 + k)) << k;
+        if (!trace_at(start + bit_ns / 2) && trace_at(start + bit_ns * 9.5) && b == sent[f]) right++;
+      }
+      break;
+    }
+  return right;
+}
+
+static bool failed = false;
+
+static void report(const char *name, uint16_t right) {
+  Serial.print(name);
+  Serial.print("  right=");
+  Serial.print((unsigned long)right);
+  Serial.print("/");
+  Serial.print((unsigned long)CHECK_BYTES);
+  Serial.println(right == CHECK_BYTES ? "  PASS" : "  FAIL");
+  if (right != CHECK_BYTES) failed = true;
+}
+
+void setup() {
+  Serial.begin(115200);
+  HAL_softSerial_init();
+  srand(1);
+  bit_ns = 1e9 / CHECK_SPEED;
+
+  report("rx, polling  ", receive(false));
+  report("rx, edge wake", receive(true));
+  report("tx only      ", transmit());
+
+  Serial.println(failed ? "FAIL" : "PASS");
+}
+
+void loop() { }